@@ -0,0 +1,211 @@
+#ifndef __BENCH__H_
+#define __BENCH__H_
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// A small microbenchmark harness. A body runs the operation state.n
+// times; the harness warms it up, picks n so one sample lasts at least
+// the minimum sample time, takes several samples and reports per
+// operation statistics as a table and optionally as JSON:
+//     bench.<name> [-f filter] [-r repetitions] [-t sample_ms] [-w warmup_ms] [-j file]
+class Bench
+{
+    typedef std::chrono::steady_clock Clock;
+
+public:
+    class State
+    {
+        friend class Bench;
+
+    public:
+        size_t const n;
+
+        // excludes setup inside the body from the sample
+        void Pause() { paused_at_ = Clock::now(); }
+        void Resume() { paused_ += Clock::now() - paused_at_; }
+
+    private:
+        explicit State(size_t n) :
+            n(n), paused_(0) { }
+
+        Clock::time_point paused_at_;
+        Clock::duration paused_;
+    };
+
+    typedef std::function<void(State&)> body_t;
+
+    struct Result {
+        std::string name;
+        size_t iterations;     // per sample
+        double items;          // processed per operation
+        std::vector<double> samples; // ns per operation
+        double mean, median, stddev, min, max;
+    };
+
+    // items counts what one operation processes, for the throughput
+    static void Add(std::string name, body_t body, double items = 1)
+    {
+        Registry_().push_back({std::move(name), std::move(body), items});
+    }
+
+    template <typename T>
+    static void DoNotOptimize(T const& value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    static void ClobberMemory() { asm volatile("" : : : "memory"); }
+
+    static auto Main(int argc, char** argv) -> int
+    {
+        std::string filter, json;
+        size_t repetitions = 10;
+        double sample_ms = 50, warmup_ms = 100;
+
+        int opt;
+        while ((opt = ::getopt(argc, argv, "f:r:t:w:j:")) != -1) {
+            switch (opt) {
+            case 'f': filter = optarg; break;
+            case 'r': repetitions = std::max(std::atol(optarg), 1l); break;
+            case 't': sample_ms = std::atof(optarg); break;
+            case 'w': warmup_ms = std::atof(optarg); break;
+            case 'j': json = optarg; break;
+            default:
+                std::fprintf(stderr, "usage: %s [-f filter] [-r repetitions] "
+                                     "[-t sample_ms] [-w warmup_ms] [-j file]\n",
+                             argv[0]);
+                return 2;
+            }
+        }
+
+        std::printf("%-44s %12s %12s %12s %8s %12s %14s\n", "benchmark", "iterations",
+                    "mean ns", "median ns", "stddev", "min ns", "items/s");
+        std::vector<Result> results;
+        for (auto const& entry : Registry_()) {
+            if (!filter.empty() && entry.name.find(filter) == std::string::npos) continue;
+            auto result = Run_(entry, repetitions, sample_ms * 1e6, warmup_ms * 1e6);
+            std::printf("%-44s %12zu %12.1f %12.1f %7.1f%% %12.1f %14.4g\n",
+                        result.name.c_str(), result.iterations, result.mean, result.median,
+                        result.mean ? 100 * result.stddev / result.mean : 0.0, result.min,
+                        result.median ? result.items * 1e9 / result.median : 0.0);
+            std::fflush(stdout);
+            results.push_back(std::move(result));
+        }
+
+        if (!json.empty() && !WriteJson_(json, results)) {
+            std::fprintf(stderr, "cannot write %s\n", json.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    struct Entry {
+        std::string name;
+        body_t body;
+        double items;
+    };
+
+    static auto Registry_() -> std::vector<Entry>&
+    {
+        static std::vector<Entry> registry;
+        return registry;
+    }
+
+    // ns taken by n operations
+    static auto Sample_(Entry const& entry, size_t n) -> double
+    {
+        State state(n);
+        auto begin = Clock::now();
+        entry.body(state);
+        auto elapsed = Clock::now() - begin - state.paused_;
+        return std::chrono::duration<double, std::nano>(elapsed).count();
+    }
+
+    static auto Run_(Entry const& entry, size_t repetitions,
+                     double sample_ns, double warmup_ns) -> Result
+    {
+        // doubles n until the warmup time is used, then scales it to
+        // the sample time
+        size_t n = 1;
+        double elapsed = 0, spent = 0;
+        while (true) {
+            elapsed = std::max(Sample_(entry, n), 1.0);
+            spent += elapsed;
+            if (spent >= warmup_ns && elapsed >= sample_ns / 10) break;
+            n *= 2;
+        }
+        n = std::max<size_t>(1, std::ceil(n * sample_ns / elapsed));
+
+        Result result {entry.name, n, entry.items, {}, 0, 0, 0, 0, 0};
+        for (size_t r = 0; r < repetitions; ++r) {
+            result.samples.push_back(Sample_(entry, n) / n);
+        }
+
+        auto sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t const count = sorted.size();
+        result.min = sorted.front();
+        result.max = sorted.back();
+        result.median = count % 2 ? sorted[count / 2]
+                                  : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+        result.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / count;
+        double variance = 0;
+        for (double s : sorted) variance += (s - result.mean) * (s - result.mean);
+        result.stddev = count > 1 ? std::sqrt(variance / (count - 1)) : 0;
+        return result;
+    }
+
+    static auto WriteJson_(std::string const& path, std::vector<Result> const& results) -> bool
+    {
+        std::string out;
+        auto it = std::back_inserter(out);
+
+        char host[256] = {};
+        ::gethostname(host, sizeof(host) - 1);
+        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::format_to(it, "{{\n  \"context\": {{\"host\": \"{}\", \"cpus\": {}, \"time\": {}}},\n"
+                           "  \"benchmarks\": [",
+                       host, std::thread::hardware_concurrency(), now);
+        for (size_t i = 0; i < results.size(); ++i) {
+            auto const& r = results[i];
+            std::format_to(it, "{}\n    {{\"name\": \"", i ? "," : "");
+            for (char c : r.name) {
+                if (c == '"' || c == '\\') out.push_back('\\');
+                out.push_back(c);
+            }
+            std::format_to(it, "\", \"iterations\": {}, \"items\": {}, \"mean_ns\": {:.3f}, "
+                               "\"median_ns\": {:.3f}, \"stddev_ns\": {:.3f}, "
+                               "\"min_ns\": {:.3f}, \"max_ns\": {:.3f}, \"samples_ns\": [",
+                           r.iterations, r.items, r.mean, r.median, r.stddev, r.min, r.max);
+            for (size_t s = 0; s < r.samples.size(); ++s) {
+                std::format_to(it, "{}{:.3f}", s ? ", " : "", r.samples[s]);
+            }
+            out.append("]}");
+        }
+        out.append("\n  ]\n}\n");
+
+        FILE* file = path == "-" ? stdout : std::fopen(path.c_str(), "w");
+        if (!file) return false;
+        bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+        if (file != stdout) ok = std::fclose(file) == 0 && ok;
+        return ok;
+    }
+};
+
+#endif // __BENCH__H_
@@ -0,0 +1,63 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.hh"
+#include "buffer/buffer.hh"
+
+// Gulp appends and socket reads, Slurp of files of growing size
+int main(int argc, char** argv)
+{
+    for (size_t size : {64, 4096, 65536}) {
+        Bench::Add(std::format("gulp.append/{}", size), [size](Bench::State& state) {
+            std::vector<std::byte> data(size);
+            Gulp gulp;
+            for (size_t i = 0; i < state.n; ++i) {
+                gulp.append(data);
+                if (gulp.size() >= (1 << 20)) gulp.clear();
+            }
+            Bench::DoNotOptimize(gulp.size());
+        },
+                   size);
+
+        // a pipe holds 64 KiB, filled outside the sample
+        Bench::Add(std::format("gulp.read/{}", size), [size](Bench::State& state) {
+            std::vector<char> data(size);
+            int fds[2];
+            if (::pipe(fds) < 0) std::abort();
+            Gulp gulp;
+            for (size_t i = 0; i < state.n; ++i) {
+                state.Pause();
+                if (::write(fds[1], data.data(), size) != ssize_t(size)) std::abort();
+                gulp.clear();
+                state.Resume();
+                while (gulp.size() < size) Bench::DoNotOptimize(gulp.read(fds[0]));
+            }
+            ::close(fds[0]);
+            ::close(fds[1]);
+        },
+                   size);
+    }
+
+    for (size_t size : {size_t(1) << 10, size_t(64) << 10, size_t(1) << 20, size_t(16) << 20}) {
+        auto path = std::format("/tmp/slurp_bench.{}.{}", ::getpid(), size);
+        {
+            std::vector<char> data(size, 'x');
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || ::write(fd, data.data(), size) != ssize_t(size)) std::abort();
+            ::close(fd);
+        }
+        Bench::Add(std::format("slurp/{}", size), [path](Bench::State& state) {
+            for (size_t i = 0; i < state.n; ++i) {
+                Slurp slurp(path);
+                Bench::DoNotOptimize(slurp.view().data());
+            }
+        },
+                   size);
+    }
+
+    int r = Bench::Main(argc, argv);
+    for (size_t size : {size_t(1) << 10, size_t(64) << 10, size_t(1) << 20, size_t(16) << 20}) {
+        ::unlink(std::format("/tmp/slurp_bench.{}.{}", ::getpid(), size).c_str());
+    }
+    return r;
+}
@@ -0,0 +1,65 @@
+#include "bench.hh"
+#include "http/http.hh"
+
+// request parsing and response composition, run from the project
+// directory so resources/ is found
+int main(int argc, char** argv)
+{
+    constexpr std::string_view request {
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:10050\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) Gecko/20100101 Firefox/119.0\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "\r\n"};
+
+    Bench::Add("http.parse", [&](Bench::State& state) {
+        HttpRequest req;
+        for (size_t i = 0; i < state.n; ++i) {
+            req.Clear();
+            Bench::DoNotOptimize(req.Parse(request));
+        }
+    },
+               request.size());
+
+    // as a connection parses, from an arena released between requests
+    Bench::Add("http.parse/arena", [&](Bench::State& state) {
+        alignas(std::max_align_t) std::byte buffer[4096];
+        std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+        HttpRequest req(&arena);
+        for (size_t i = 0; i < state.n; ++i) {
+            if (req.Clear()) arena.release();
+            Bench::DoNotOptimize(req.Parse(request));
+        }
+    },
+               request.size());
+
+    for (std::string_view path : {"/index.html", "/images/profile-image.jpg", "/missing"}) {
+        Bench::Add(std::format("http.compose{}", path), [path](Bench::State& state) {
+            HttpResponse res;
+            for (size_t i = 0; i < state.n; ++i) {
+                res.Init("resources", path, HttpCode::OK, true);
+                res.Compose();
+                Bench::DoNotOptimize(res.FileView().data());
+            }
+        });
+
+        Bench::Add(std::format("http.compose/arena{}", path), [path](Bench::State& state) {
+            alignas(std::max_align_t) std::byte buffer[4096];
+            std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+            HttpResponse res(&arena);
+            for (size_t i = 0; i < state.n; ++i) {
+                res.Clear();
+                arena.release();
+                res.Init("resources", path, HttpCode::OK, true);
+                res.Compose();
+                Bench::DoNotOptimize(res.FileView().data());
+            }
+        });
+    }
+
+    return Bench::Main(argc, argv);
+}
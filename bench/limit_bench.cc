@@ -0,0 +1,59 @@
+#include <random>
+
+#include "bench.hh"
+#include "server/server.hh"
+
+// ClientLimiter checks with a million client IPs tracked, each looked
+// up in random order so most lookups miss the cache like a busy server
+int main(int argc, char** argv)
+{
+    constexpr size_t ips = 1 << 20;
+
+    std::mt19937 random(42);
+    std::vector<in_addr_t> addrs(ips);
+    for (auto& addr : addrs) addr = random() | 1;
+    std::vector<in_addr_t> order(addrs);
+    std::shuffle(order.begin(), order.end(), random);
+
+    // rated high enough that every request is admitted and updated
+    ClientLimiter limiter({.rate = 1e6, .burst = 16, .max_connections = 64, .capacity = ips});
+    for (auto addr : addrs) limiter.Connect(addr, 0);
+    std::printf("tracked %zu of %zu IPs\n", limiter.Size(), ips);
+
+    int64_t now = 0;
+    Bench::Add("limit.request", [&](Bench::State& state) {
+        for (size_t i = 0; i < state.n; ++i) {
+            Bench::DoNotOptimize(limiter.Request(order[i & (ips - 1)], ++now));
+        }
+    });
+
+    Bench::Add("limit.connect+disconnect", [&](Bench::State& state) {
+        for (size_t i = 0; i < state.n; ++i) {
+            auto addr = order[i & (ips - 1)];
+            Bench::DoNotOptimize(limiter.Connect(addr, ++now));
+            limiter.Disconnect(addr);
+        }
+    });
+
+    // IPs not in the table, the probe runs to an empty slot
+    Bench::Add("limit.request/untracked", [&](Bench::State& state) {
+        for (size_t i = 0; i < state.n; ++i) {
+            Bench::DoNotOptimize(limiter.Request(order[i & (ips - 1)] + 1, ++now));
+        }
+    });
+
+    // IPs come once and go, evicted as soon as they are idle; evicted
+    // slots must not pile up and lengthen the probes
+    ClientLimiter churn({.max_connections = 64, .idle = 0, .capacity = 4096});
+    uint32_t next = 1;
+    Bench::Add("limit.connect/churn", [&](Bench::State& state) {
+        for (size_t i = 0; i < state.n; ++i) {
+            auto addr = (next++ * 2654435761u) | 1;
+            Bench::DoNotOptimize(churn.Connect(addr, ++now));
+            churn.Disconnect(addr);
+            if (!(i & 15)) churn.Evict(++now);
+        }
+    });
+
+    return Bench::Main(argc, argv);
+}
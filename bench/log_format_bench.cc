@@ -0,0 +1,35 @@
+#include "bench.hh"
+#include "log/log.hh"
+
+// per-record cost of the runtime and the compile-time pattern path
+int main(int argc, char** argv)
+{
+    auto logger = std::make_shared<Logger>(LogLevel::DEBUG, "bench");
+    LogInfo info(logger.get(), LogLevel::INFO);
+    auto event = LogEvent::Make(std::source_location::current(),
+                                "add client {} from {}", 42, "127.0.0.1");
+
+    auto add = [&](std::string_view kind, std::string_view pattern, LogFormatter::ptr formatter) {
+        Bench::Add(std::format("format.{}/{}", kind, pattern), [&, formatter](Bench::State& state) {
+            std::string out;
+            for (size_t i = 0; i < state.n; ++i) {
+                out.clear();
+                formatter->Format(out, info, event);
+            }
+            Bench::DoNotOptimize(out.data());
+        });
+    };
+
+#define BENCH(pattern)                                                   \
+    add("runtime", pattern, std::make_shared<LogFormatter>(pattern)); \
+    add("compiled", pattern, LogFormatter::Compile<pattern>())
+
+    BENCH("[%d] [%p] [T:%t F:%f X:%x] %m%n");
+    BENCH("[%D] [%p] %m%n");
+    BENCH("[%p] [T:%t F:%f X:%x] %m%n");
+    BENCH("%m%n");
+
+#undef BENCH
+
+    return Bench::Main(argc, argv);
+}
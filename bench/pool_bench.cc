@@ -0,0 +1,37 @@
+#include <atomic>
+#include <thread>
+
+#include "bench.hh"
+#include "thread/thread.hh"
+
+// ThreadPool::AddTask throughput with 1 to 8 producers feeding 4
+// workers, for both queue disciplines; an operation is one task
+// submitted and run
+int main(int argc, char** argv)
+{
+    auto fifo = std::make_shared<ThreadPool>(4);
+    // the discipline only costs when the queue stands
+    auto adaptive = std::make_shared<ThreadPool>(
+        4, ThreadPool::Options {ThreadPool::Discipline::ADAPTIVE, 5, 100, 1000});
+
+    for (auto [name, pool] : {std::pair {"fifo", fifo}, std::pair {"adaptive", adaptive}}) {
+        for (size_t producers : {1, 2, 4, 8}) {
+            Bench::Add(std::format("pool.add_task/{}/{}", name, producers), [pool, producers](Bench::State& state) {
+                std::atomic<size_t> done = 0;
+                std::vector<std::thread> threads;
+                for (size_t p = 0; p < producers; ++p) {
+                    size_t count = state.n / producers + (p < state.n % producers);
+                    threads.emplace_back([&pool, &done, count] {
+                        for (size_t i = 0; i < count; ++i) {
+                            pool->AddTask([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                        }
+                    });
+                }
+                for (auto& thread : threads) thread.join();
+                while (done.load(std::memory_order_relaxed) < state.n) std::this_thread::yield();
+            });
+        }
+    }
+
+    return Bench::Main(argc, argv);
+}
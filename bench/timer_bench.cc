@@ -0,0 +1,67 @@
+#include <random>
+
+#include "bench.hh"
+#include "priority_queue.hh"
+#include "timer/timer.hh"
+
+// MapPriorityQueue and Timer kept at a steady size while pushing,
+// adjusting and popping
+int main(int argc, char** argv)
+{
+    typedef MapPriorityQueue<int, int64_t, std::greater<int64_t>> queue_t;
+
+    for (int size : {1'000, 10'000, 100'000, 1'000'000}) {
+        // filled once outside the samples, every operation keeps the size
+        auto queue = std::make_shared<queue_t>();
+        auto fill = [queue, size] {
+            if (!queue->empty()) return;
+            std::minstd_rand engine(size);
+            for (int i = 0; i < size; ++i) queue->push(i, int64_t(engine() % 1'000'000));
+        };
+
+        // fresh ids replace the popped ones, like new connections
+        auto next_id = std::make_shared<int>(size);
+        Bench::Add(std::format("pq.pop_push/{}", size), [queue, fill, next_id](Bench::State& state) {
+            state.Pause();
+            fill();
+            std::minstd_rand engine(state.n);
+            int64_t now = 1'000'000;
+            state.Resume();
+            for (size_t i = 0; i < state.n; ++i) {
+                queue->pop();
+                queue->push((*next_id)++, now + int64_t(engine() % 1'000'000));
+                ++now;
+            }
+            Bench::DoNotOptimize(queue->top());
+        });
+
+        Bench::Add(std::format("pq.adjust/{}", size), [queue, fill, size](Bench::State& state) {
+            state.Pause();
+            queue->clear();
+            fill();
+            std::minstd_rand engine(state.n);
+            state.Resume();
+            for (size_t i = 0; i < state.n; ++i) {
+                queue->set(int(engine() % size), int64_t(engine() % 1'000'000));
+            }
+            Bench::DoNotOptimize(queue->top());
+        });
+
+        // connections whose timeout is extended on every request
+        auto timer = std::make_shared<Timer>();
+        Bench::Add(std::format("timer.adjust/{}", size), [timer, size](Bench::State& state) {
+            state.Pause();
+            if (timer->Empty()) {
+                for (int i = 0; i < size; ++i) timer->AddEvent(i, 60'000 + i % 1000, [] {});
+            }
+            std::minstd_rand engine(state.n);
+            state.Resume();
+            for (size_t i = 0; i < state.n; ++i) {
+                timer->AdjustEvent(int(engine() % size), 60'000);
+            }
+            Bench::DoNotOptimize(timer->Size());
+        });
+    }
+
+    return Bench::Main(argc, argv);
+}
@@ -0,0 +1,14 @@
+add_includedirs("../src")
+
+-- bench.<name> [-f filter] [-r repetitions] [-t sample_ms] [-w warmup_ms] [-j file]
+for _, file in ipairs(os.files("*.cc")) do
+    local name = path.basename(file)
+    target("bench." .. name)
+        set_group("bench")
+        set_default(false)
+        set_kind("binary")
+        set_rundir(os.projectdir())
+        add_files(file)
+        add_deps("log", "buffer", "http", "timer", "thread", "server")
+    target_end()
+end
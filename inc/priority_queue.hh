@@ -67,7 +67,7 @@ public:
     {
         swap_(i, size() - 1);
         element_.pop_back();
-        shift_(i);
+        if (i < size()) shift_(i);
     }
 
     void swap(self& other)
@@ -206,8 +206,9 @@ private:
     void pop_(size_t i)
     {
         swap_(i, size() - 1);
+        index_.erase(element_.back().first);
         element_.pop_back();
-        shift_(i);
+        if (i < size()) shift_(i);
     }
 
     auto shift_(size_t i) -> size_t
@@ -327,7 +328,7 @@ public:
         swap_(i, size() - 1);
         pq_.pop_back();
         element_.pop_back();
-        shift_(i);
+        if (i < size()) shift_(i);
     }
 
     void del(size_t i)
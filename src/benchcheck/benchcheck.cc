@@ -0,0 +1,418 @@
+// Load regression check: runs a fixed matrix of server setups under
+// webbench and compares them with a stored baseline:
+//     benchcheck [-b baseline] [-o results] [-u] [-f filter] [-d seconds]
+//                [-n repetitions] [-c connections] [-p port] [-S server] [-W webbench]
+// Each scenario starts the server with a generated config (trigger
+// mode, pool threads), serves one generated file (1k, 64k, 1m) with
+// keep-alive on or off, and takes the median of the repetitions. The
+// socket/ scenarios turn on one server.socket option each, on the
+// workload it is meant for. A scenario regresses when its throughput
+// falls, or its p99 latency rises, by more than the tolerance widened
+// by the noise seen in either run. -u writes the results into the baseline, keeping the
+// scenarios filtered out. Exits 1 on a regression.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <yaml-cpp/yaml.h>
+
+namespace
+{
+constexpr double rps_tolerance = 0.05; // 5% less throughput
+constexpr double p99_tolerance = 0.15; // 15% more tail latency
+constexpr double noise_factor = 2;     // times the relative spread
+
+struct Options {
+    std::string baseline = "bench/baseline.json";
+    std::string output;
+    bool update = false;
+    std::string filter;
+    double seconds = 2;
+    int repetitions = 3;
+    int connections = 32;
+    int port = 10060;
+    std::string server;
+    std::string webbench;
+};
+
+struct Scenario {
+    int trigger_mode;
+    int threads;
+    std::string file;
+    size_t size;
+    bool keep_alive;
+    // the name and the lines of server.socket, none for the defaults
+    std::string socket = "";
+    std::string socket_yaml = "";
+
+    auto Name() const -> std::string
+    {
+        if (!socket.empty()) {
+            return std::format("socket/{}/{}/{}", socket, file, keep_alive ? "keep-alive" : "close");
+        }
+        return std::format("mode{}/threads{}/{}/{}", trigger_mode, threads, file,
+                           keep_alive ? "keep-alive" : "close");
+    }
+};
+
+struct Result {
+    std::string name;
+    std::vector<double> rps, p99;
+    double rps_median = 0, rps_spread = 0;
+    double p99_median = 0, p99_spread = 0;
+};
+
+auto Median(std::vector<double> v) -> double
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// (max - min) / median, the noise of a scenario
+auto Spread(std::vector<double> const& v, double median) -> double
+{
+    if (v.size() < 2 || median <= 0) return 0;
+    auto [min, max] = std::minmax_element(v.begin(), v.end());
+    return (*max - *min) / median;
+}
+
+auto Matrix() -> std::vector<Scenario>
+{
+    std::vector<Scenario> matrix;
+    for (int mode : {0, 1, 2, 3}) {
+        for (int threads : {1, 4}) {
+            for (auto [file, size] : {std::pair {"1k", size_t(1) << 10},
+                                      std::pair {"64k", size_t(64) << 10},
+                                      std::pair {"1m", size_t(1) << 20}}) {
+                for (bool keep_alive : {true, false}) {
+                    matrix.push_back({mode, threads, file, size, keep_alive});
+                }
+            }
+        }
+    }
+
+    // edge triggered, 4 threads; connection setup options on short
+    // connections, the others where they act on the responses
+    struct {
+        char const* name;
+        char const* yaml;
+        char const* file;
+        size_t size;
+        bool keep_alive;
+    } const socket[] {
+        {"default", "", "1k", 1 << 10, false},
+        {"default", "", "64k", 64 << 10, true},
+        {"backlog=8", "    backlog: 8\n", "1k", 1 << 10, false},
+        {"defer_accept=1", "    defer_accept: 1\n", "1k", 1 << 10, false},
+        {"fastopen=256", "    fastopen: 256\n", "1k", 1 << 10, false},
+        {"nodelay", "    nodelay: true\n", "1k", 1 << 10, true},
+        {"busy_poll=50", "    busy_poll: 50\n", "1k", 1 << 10, true},
+        {"cork", "    cork: true\n", "64k", 64 << 10, true},
+        {"notsent_lowat=16k", "    notsent_lowat: 16384\n", "1m", 1 << 20, true},
+        {"buffers=256k", "    sndbuf: 262144\n    rcvbuf: 262144\n", "1m", 1 << 20, true},
+    };
+    for (auto const& s : socket) {
+        matrix.push_back({3, 4, s.file, s.size, s.keep_alive, s.name, s.yaml});
+    }
+    return matrix;
+}
+
+// a server that only logs warnings, into the work directory
+void WriteConfig(std::filesystem::path const& path, std::filesystem::path const& dir,
+                 Scenario const& scenario, int port)
+{
+    std::ofstream out(path);
+    out << std::format(
+        "server:\n"
+        "  src_dir: {}/www/\n"
+        "  port: {}\n"
+        "  trigger_mode: {}\n"
+        "  timeout: 60000\n"
+        "  opt_linger: false\n"
+        "  thread:\n"
+        "    count: {}\n"
+        "  socket:\n"
+        "{}"
+        "log:\n"
+        "  format:\n"
+        "    basic: \"[%d] [%p] %m%n\"\n"
+        "  appender:\n"
+        "    - name: file\n"
+        "      level: WARN\n"
+        "      format: basic\n"
+        "      filename: {}/server.log\n"
+        "  logger:\n"
+        "    - name: root\n"
+        "      level: WARN\n"
+        "      appenders: [file]\n",
+        dir.native(), port, scenario.trigger_mode, scenario.threads,
+        scenario.socket_yaml.empty() ? "    backlog: 1024\n" : scenario.socket_yaml, dir.native());
+}
+
+// quiet sends the standard output to /dev/null
+auto Spawn(std::vector<std::string> const& args, bool quiet) -> pid_t
+{
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        if (quiet) {
+            int fd = ::open("/dev/null", O_WRONLY);
+            ::dup2(fd, STDOUT_FILENO);
+        }
+        std::vector<char*> argv;
+        for (auto const& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        ::execv(argv[0], argv.data());
+        std::perror(argv[0]);
+        ::_exit(127);
+    }
+    return pid;
+}
+
+auto WaitListening(int port, pid_t pid) -> bool
+{
+    ::sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 100; ++i) {
+        if (::waitpid(pid, nullptr, WNOHANG) == pid) return false;
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool ok = ::connect(fd, (::sockaddr*)&addr, sizeof(addr)) == 0;
+        ::close(fd);
+        if (ok) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return false;
+}
+
+auto Run(Options const& options, std::filesystem::path const& dir,
+         Scenario const& scenario, Result& result) -> bool
+{
+    auto config = dir / "server.yaml";
+    WriteConfig(config, dir, scenario, options.port);
+    pid_t server = Spawn({options.server, config.native()}, true);
+    if (!WaitListening(options.port, server)) {
+        std::cerr << "benchcheck: server did not start, see " << (dir / "server.log") << std::endl;
+        ::kill(server, SIGKILL);
+        ::waitpid(server, nullptr, 0);
+        return false;
+    }
+
+    bool ok = true;
+    auto json = dir / "webbench.json";
+    for (int r = 0; r < options.repetitions && ok; ++r) {
+        std::vector<std::string> args {options.webbench,
+                                       "-p", std::to_string(options.port),
+                                       "-c", std::to_string(options.connections),
+                                       "-t", "2",
+                                       "-d", std::to_string(options.seconds),
+                                       "-u", "/" + scenario.file,
+                                       "-j", json.native()};
+        if (!scenario.keep_alive) args.push_back("-K");
+        pid_t bench = Spawn(args, true);
+        int status = 0;
+        ::waitpid(bench, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "benchcheck: webbench failed on " << scenario.Name() << ": "
+                      << (WIFEXITED(status) ? std::format("exit {}", WEXITSTATUS(status))
+                                            : std::format("signal {}", WTERMSIG(status)))
+                      << std::endl;
+            ok = false;
+            break;
+        }
+        auto node = YAML::LoadFile(json.native());
+        result.rps.push_back(node["requests_per_second"].as<double>());
+        result.p99.push_back(node["latency_ms"]["p99"].as<double>());
+    }
+
+    ::kill(server, SIGTERM);
+    ::waitpid(server, nullptr, 0);
+
+    result.rps_median = Median(result.rps);
+    result.rps_spread = Spread(result.rps, result.rps_median);
+    result.p99_median = Median(result.p99);
+    result.p99_spread = Spread(result.p99, result.p99_median);
+    return ok;
+}
+
+auto ToJson(std::vector<Result> const& results, Options const& options) -> std::string
+{
+    auto list = [](std::vector<double> const& v) {
+        std::string out;
+        for (size_t i = 0; i < v.size(); ++i) out += std::format("{}{:.3f}", i ? ", " : "", v[i]);
+        return out;
+    };
+
+    std::string out = std::format(
+        "{{\n  \"context\": {{\"seconds\": {}, \"repetitions\": {}, \"connections\": {}, \"cpus\": {}}},\n"
+        "  \"scenarios\": [",
+        options.seconds, options.repetitions, options.connections,
+        std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto const& r = results[i];
+        out += std::format("{}\n    {{\"name\": \"{}\", \"requests_per_second\": {:.1f}, "
+                           "\"rps_spread\": {:.4f}, \"p99_ms\": {:.3f}, \"p99_spread\": {:.4f}, "
+                           "\"rps_samples\": [{}], \"p99_samples\": [{}]}}",
+                           i ? "," : "", r.name, r.rps_median, r.rps_spread, r.p99_median,
+                           r.p99_spread, list(r.rps), list(r.p99));
+    }
+    out += "\n  ]\n}\n";
+    return out;
+}
+
+auto FromYaml(YAML::Node const& node) -> Result
+{
+    Result r {node["name"].as<std::string>()};
+    r.rps = node["rps_samples"].as<std::vector<double>>();
+    r.p99 = node["p99_samples"].as<std::vector<double>>();
+    r.rps_median = node["requests_per_second"].as<double>();
+    r.rps_spread = node["rps_spread"].as<double>();
+    r.p99_median = node["p99_ms"].as<double>();
+    r.p99_spread = node["p99_spread"].as<double>();
+    return r;
+}
+
+// the directory of this executable, xmake builds every target there
+auto SelfDir() -> std::filesystem::path
+{
+    std::error_code ec;
+    auto self = std::filesystem::read_symlink("/proc/self/exe", ec);
+    return ec ? std::filesystem::path(".") : self.parent_path();
+}
+
+void Usage(char const* name)
+{
+    std::cerr << "usage: " << name
+              << " [-b baseline] [-o results] [-u] [-f filter] [-d seconds]\n"
+                 "       [-n repetitions] [-c connections] [-p port] [-S server] [-W webbench]"
+              << std::endl;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "b:o:uf:d:n:c:p:S:W:")) != -1) {
+        switch (opt) {
+        case 'b': options.baseline = optarg; break;
+        case 'o': options.output = optarg; break;
+        case 'u': options.update = true; break;
+        case 'f': options.filter = optarg; break;
+        case 'd': options.seconds = std::atof(optarg); break;
+        case 'n': options.repetitions = std::max(std::atoi(optarg), 1); break;
+        case 'c': options.connections = std::max(std::atoi(optarg), 1); break;
+        case 'p': options.port = std::atoi(optarg); break;
+        case 'S': options.server = optarg; break;
+        case 'W': options.webbench = optarg; break;
+        default: Usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc) {
+        Usage(argv[0]);
+        return 2;
+    }
+    if (options.server.empty()) options.server = SelfDir() / "web-server";
+    if (options.webbench.empty()) options.webbench = SelfDir() / "webbench";
+
+    // the files served, in a scratch directory
+    char dir_template[] = "/tmp/benchcheck.XXXXXX";
+    if (!::mkdtemp(dir_template)) {
+        std::perror("benchcheck: mkdtemp");
+        return 2;
+    }
+    std::filesystem::path const dir = dir_template;
+    std::filesystem::create_directory(dir / "www");
+    auto const matrix = Matrix();
+    for (auto const& scenario : matrix) {
+        auto path = dir / "www" / scenario.file;
+        if (std::filesystem::exists(path)) continue;
+        std::ofstream(path) << std::string(scenario.size, 'x');
+    }
+
+    std::map<std::string, YAML::Node> baseline;
+    try {
+        for (auto const& node : YAML::LoadFile(options.baseline)["scenarios"]) {
+            baseline.emplace(node["name"].as<std::string>(), YAML::Node(node));
+        }
+    } catch (std::exception const& e) {
+        if (!options.update) {
+            std::cerr << "benchcheck: no baseline " << options.baseline << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::printf("%-36s %12s %10s %10s %10s %8s\n", "scenario", "req/s", "change", "p99 ms", "change", "");
+    std::vector<Result> results;
+    int regressions = 0, failures = 0;
+    for (auto const& scenario : matrix) {
+        Result result {scenario.Name()};
+        if (!options.filter.empty() && result.name.find(options.filter) == std::string::npos)
+            continue;
+        if (!Run(options, dir, scenario, result)) {
+            ++failures;
+            continue;
+        }
+
+        std::string rps_change = "-", p99_change = "-", verdict = "new";
+        if (auto it = baseline.find(result.name); it != baseline.end() && !options.update) {
+            auto const& base = it->second;
+            double base_rps = base["requests_per_second"].as<double>();
+            double base_p99 = base["p99_ms"].as<double>();
+            double rps_tol = std::max(rps_tolerance, noise_factor * std::max(base["rps_spread"].as<double>(),
+                                                                             result.rps_spread));
+            double p99_tol = std::max(p99_tolerance, noise_factor * std::max(base["p99_spread"].as<double>(),
+                                                                             result.p99_spread));
+            double rps_delta = base_rps > 0 ? result.rps_median / base_rps - 1 : 0;
+            double p99_delta = base_p99 > 0 ? result.p99_median / base_p99 - 1 : 0;
+            rps_change = std::format("{:+.1f}%", rps_delta * 100);
+            p99_change = std::format("{:+.1f}%", p99_delta * 100);
+            bool regressed = rps_delta < -rps_tol || p99_delta > p99_tol;
+            verdict = regressed ? "REGRESSED" : "ok";
+            regressions += regressed;
+        }
+        std::printf("%-36s %12.1f %10s %10.3f %10s %8s\n", result.name.c_str(), result.rps_median,
+                    rps_change.c_str(), result.p99_median, p99_change.c_str(), verdict.c_str());
+        std::fflush(stdout);
+        results.push_back(std::move(result));
+    }
+
+    auto json = ToJson(results, options);
+    if (!options.output.empty()) std::ofstream(options.output) << json;
+    if (options.update) {
+        // scenarios not run keep their baseline, in matrix order
+        std::vector<Result> merged;
+        for (auto const& scenario : matrix) {
+            auto name = scenario.Name();
+            auto run = std::ranges::find(results, name, &Result::name);
+            if (run != results.end()) merged.push_back(*run);
+            else if (auto it = baseline.find(name); it != baseline.end()) merged.push_back(FromYaml(it->second));
+        }
+        std::ofstream(options.baseline) << ToJson(merged, options);
+        std::printf("baseline written to %s\n", options.baseline.c_str());
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+
+    if (failures) std::printf("%d scenarios failed to run\n", failures);
+    if (regressions) std::printf("%d scenarios regressed\n", regressions);
+    return regressions || failures ? 1 : 0;
+}
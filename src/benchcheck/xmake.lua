@@ -0,0 +1,6 @@
+target("benchcheck")
+    set_kind("binary")
+    set_rundir(os.projectdir())
+    add_files("*.cc")
+    add_deps("web-server", "webbench")
+    add_packages("yaml-cpp")
@@ -2,69 +2,237 @@
 
 #include "utils.hh"
 
-Gulp::~Gulp()
+#include <algorithm>
+#include <new>
+
+thread_local BlockPool::List BlockPool::free_;
+thread_local bool BlockPool::exited_ = false;
+
+auto BlockPool::Acquire() -> std::byte*
 {
-    if (cow_) return;
-    if (data_) ::free(data_);
-    reset_();
+    if (!exited_ && free_.head) {
+        auto* node = free_.head;
+        free_.head = node->next;
+        --free_.size;
+        return (std::byte*)node;
+    }
+    void* p;
+    invoke_throw_posix_error(::posix_memalign, &p, ALIGN_SIZE, BLOCK_SIZE);
+    return (std::byte*)p;
+}
+
+void BlockPool::Release(std::byte* block)
+{
+    if (exited_ || free_.size >= MAX_FREE) {
+        ::free(block);
+        return;
+    }
+    free_.head = new (block) Node {free_.head};
+    ++free_.size;
 }
 
-void Gulp::reserve(size_t sz)
+auto BlockPool::Free() -> size_t
 {
-    if (sz <= capacity()) return;
-    sz = round_up(sz, ALIGN_SIZE);
+    return exited_ ? 0 : free_.size;
+}
 
-    void* p;
-    invoke_throw_posix_error(::posix_memalign, &p, ALIGN_SIZE, sz);
-    std::memcpy(p, begin(), size());
-    data_ = (std::byte*)p;
-    len_ = sz;
-    write_ -= read_;
-    read_ = 0;
-    cow_ = false;
+BlockPool::List::~List()
+{
+    exited_ = true;
+    while (head) {
+        auto* next = head->next;
+        ::free(head);
+        head = next;
+    }
+    size = 0;
+}
+
+void Gulp::clear()
+{
+    check_();
+    release_all_();
+}
+
+void Gulp::consume(size_t n)
+{
+    check_();
+    assert(n <= size_);
+    if (n == size_) {
+        clear();
+        return;
+    }
+    size_ -= n;
+    // only full blocks are dropped, the last one still holds bytes
+    while (n) {
+        size_t used = blocks_.front().len - head_;
+        if (blocks_.size() == 1 || n < used) {
+            head_ += n;
+            break;
+        }
+        release_(blocks_.front());
+        blocks_.erase(blocks_.begin());
+        head_ = 0;
+        n -= used;
+    }
 }
 
 auto Gulp::read(int fd) -> ssize_t
 {
-    reserve(size() + 1);
-    std::byte buf[SOCKET_PACKAGE_MAX_SIZE - ALIGN_SIZE];
+    constexpr size_t MAX_FRESH = READ_SIZE / BlockPool::BLOCK_SIZE;
+    check_();
 
-    size_t vacant = capacity() - size();
-    ::iovec iov[2] {
-        {.iov_base = end_(), .iov_len = vacant     },
-        {.iov_base = buf,    .iov_len = sizeof(buf)},
-    };
-    ssize_t len = ::readv(fd, iov, sizeof(iov) / sizeof(iov[0]));
-    if (len < 0) return ~errno;
-    if (size_t(len) <= vacant) write_ += len;
-    else {
-        write_ += vacant;
-        append({buf, len - vacant});
+    // the room left in the last block and one fresh block; once a read
+    // fills them, the rest of READ_SIZE in fresh blocks
+    size_t total = 0;
+    size_t want = 1;
+    while (true) {
+        ::iovec iov[MAX_FRESH + 1];
+        int count = 0;
+        size_t vacant = vacant_();
+        if (vacant) iov[count++] = {.iov_base = blocks_.back().data + tail_, .iov_len = vacant};
+        std::byte* fresh[MAX_FRESH];
+        for (size_t i = 0; i < want; ++i) {
+            fresh[i] = BlockPool::Acquire();
+            iov[count++] = {.iov_base = fresh[i], .iov_len = BlockPool::BLOCK_SIZE};
+        }
+
+        ssize_t len = ::readv(fd, iov, count);
+        int error = errno;
+
+        size_t left = len > 0 ? size_t(len) : 0;
+        size_ += left;
+        total += left;
+        size_t taken = std::min(left, vacant);
+        tail_ += taken;
+        left -= taken;
+        bool filled = left == want * BlockPool::BLOCK_SIZE;
+        for (size_t i = 0; i < want; ++i) {
+            if (!left) {
+                BlockPool::Release(fresh[i]);
+                continue;
+            }
+            blocks_.push_back({fresh[i], BlockPool::BLOCK_SIZE, Block::POOLED});
+            tail_ = std::min(left, BlockPool::BLOCK_SIZE);
+            left -= tail_;
+        }
+
+        // what was read counts, an error comes again on the next read
+        if (len < 0) return total ? ssize_t(total) : ~error;
+        if (!filled || total >= READ_SIZE) return total;
+        want = std::max<size_t>((READ_SIZE - total) / BlockPool::BLOCK_SIZE, 1);
     }
-    return len;
 }
 
 auto Gulp::write(int fd) -> ssize_t
 {
-    ssize_t len = ::write(fd, begin(), size());
+    check_();
+    ::iovec iov[MAX_IOV];
+    int count = 0;
+    for (size_t i = 0; i < blocks_.size() && count < int(MAX_IOV); ++i) {
+        auto const& block = blocks_[i];
+        size_t begin = i == 0 ? head_ : 0;
+        size_t end = i + 1 == blocks_.size() ? tail_ : block.len;
+        if (end > begin) iov[count++] = {.iov_base = block.data + begin, .iov_len = end - begin};
+    }
+    if (!count) return 0;
+
+    ssize_t len = ::writev(fd, iov, count);
     if (len < 0) return ~errno;
-    read_ += len;
+    consume(len);
     return len;
 }
 
-void Gulp::append(std::span<std::byte> span)
+void Gulp::append(std::span<std::byte const> span)
 {
     assert(span.data() && !span.empty());
-    reserve(size() + span.size());
-    std::memcpy(end_(), span.data(), span.size());
-    write_ += span.size();
+    check_();
+    size_ += span.size();
+    while (!span.empty()) {
+        size_t vacant = vacant_();
+        if (!vacant) {
+            blocks_.push_back({BlockPool::Acquire(), BlockPool::BLOCK_SIZE, Block::POOLED});
+            tail_ = 0;
+            vacant = BlockPool::BLOCK_SIZE;
+        }
+        size_t len = std::min(vacant, span.size());
+        std::memcpy(blocks_.back().data + tail_, span.data(), len);
+        tail_ += len;
+        span = span.subspan(len);
+    }
+}
+
+auto Gulp::share(std::shared_ptr<void const> owner, std::span<std::byte const> bytes) -> self&
+{
+    check_();
+    if (bytes.empty()) return *this;
+    // the last block ends at its bytes, so every block but the new
+    // one stays full and appends take a fresh block
+    if (!blocks_.empty()) blocks_.back().len = tail_;
+    blocks_.push_back({const_cast<iterator>(bytes.data()), bytes.size(),
+                       Block::SHARED, std::move(owner)});
+    tail_ = bytes.size();
+    size_ += bytes.size();
+    return *this;
+}
+
+auto Gulp::linear_() -> iterator
+{
+    check_();
+    if (blocks_.empty()) return nullptr;
+    if (blocks_.size() == 1) return blocks_.front().data + head_;
+
+    Block block;
+    if (size_ <= BlockPool::BLOCK_SIZE) {
+        block = {BlockPool::Acquire(), BlockPool::BLOCK_SIZE, Block::POOLED};
+    } else {
+        size_t len = round_up(size_, BlockPool::BLOCK_SIZE);
+        void* p;
+        invoke_throw_posix_error(::posix_memalign, &p, BlockPool::ALIGN_SIZE, len);
+        block = {(iterator)p, len, Block::HEAP};
+    }
+
+    auto out = block.data;
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        size_t begin = i == 0 ? head_ : 0;
+        size_t end = i + 1 == blocks_.size() ? tail_ : blocks_[i].len;
+        out = std::copy(blocks_[i].data + begin, blocks_[i].data + end, out);
+    }
+
+    size_t size = size_;
+    clear();
+    blocks_.push_back(block);
+    tail_ = size_ = size;
+    return block.data;
+}
+
+void Gulp::release_(Block const& block)
+{
+    switch (block.kind) {
+    case Block::POOLED: BlockPool::Release(block.data); break;
+    case Block::HEAP: ::free(block.data); break;
+    case Block::SHARED: break;
+    }
+}
+
+void Gulp::release_all_()
+{
+    for (auto const& block : blocks_) release_(block);
+    blocks_.clear();
+    reset_();
+}
+
+#ifndef NDEBUG
+void Gulp::check_() const
+{
+    auto self = std::this_thread::get_id();
+    if (owner_ == std::thread::id()) owner_ = self;
+    assert(owner_ == self && "Gulp used by a second thread without a handoff");
 }
+#endif
 
 void Gulp::reset_()
 {
-    data_ = nullptr;
-    len_ = read_ = write_ = 0;
-    cow_ = false;
+    head_ = tail_ = size_ = 0;
 }
 
 Slurp::Slurp(std::string_view path) :
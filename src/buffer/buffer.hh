@@ -9,8 +9,10 @@
 
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <span>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <fcntl.h>
@@ -21,10 +23,58 @@
 
 #include "magic_enum.hh"
 
+// Fixed-size aligned blocks recycled through a free list per thread,
+// so socket buffers cost no allocation once a thread is warm. A block
+// released on another thread joins that thread's list.
+class BlockPool
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 16 << 10;
+    static constexpr size_t ALIGN_SIZE = 1 << 12;
+    // blocks a thread keeps, the rest go back to malloc
+    static constexpr size_t MAX_FREE = 256;
+
+    static auto Acquire() -> std::byte*;
+    static void Release(std::byte* block);
+
+    // blocks cached by the calling thread
+    static auto Free() -> size_t;
+
+private:
+    struct Node {
+        Node* next;
+    };
+
+    struct List {
+        Node* head = nullptr;
+        size_t size = 0;
+        ~List();
+    };
+
+    static thread_local List free_;
+    // blocks released after the thread's list is gone are freed
+    static thread_local bool exited_;
+};
+
+// A byte queue kept as a chain of pooled blocks. Reads go straight into
+// the blocks and every block returns to the pool once consumed, so an
+// empty Gulp holds no buffer memory. Views need contiguous bytes: a
+// chain of more than one block is copied into one first.
+//
+// Bytes owned elsewhere join the chain with share(), which keeps their
+// owner alive until they are consumed. Nothing on the request path
+// shares bytes yet: requests are read into pooled blocks and moved
+// whole into HttpRequest, and response bodies are written from their
+// own spans, kept alive by HttpConnection's pins rather than a Gulp.
+//
+// A Gulp has one owner thread at a time and no synchronization. The
+// owner calls handoff() before another thread may take it over, debug
+// builds assert on a use by a second thread without one.
 class Gulp
 {
-    static constexpr size_t SOCKET_PACKAGE_MAX_SIZE = 65535;
-    static constexpr size_t ALIGN_SIZE = 1 << 8;
+    // a read stops once it took this many bytes
+    static constexpr size_t READ_SIZE = 64 << 10;
+    static constexpr size_t MAX_IOV = 64;
 
 public:
     typedef std::byte* iterator;
@@ -33,92 +83,126 @@ public:
     typedef Gulp self;
 
     Gulp() :
-        data_(nullptr), len_(0),
-        read_(0), write_(0), cow_(false) { }
+        head_(0), tail_(0), size_(0) { }
 
     Gulp(self const&) = delete;
     auto operator=(self const&) -> self& = delete;
 
     Gulp(self&& other) :
-        data_(other.data_), len_(other.len_)
+        blocks_((other.check_(), std::move(other.blocks_))),
+        head_(other.head_), tail_(other.tail_), size_(other.size_)
     {
-        read_.exchange(other.read_);
-        write_.exchange(other.write_);
-        cow_.exchange(other.cow_);
         other.reset_();
     }
 
+    // swaps the block lists, so neither side allocates one again
     auto operator=(self&& other) -> self&
     {
-        this->~Gulp();
-        data_ = other.data_;
-        len_ = other.len_;
-        read_.exchange(other.read_);
-        write_.exchange(other.write_);
-        cow_.exchange(other.cow_);
-        other.data_ = nullptr;
-        other.len_ = 0;
+        if (this == &other) return *this;
+        other.check_();
+        clear();
+        blocks_.swap(other.blocks_);
+        head_ = other.head_;
+        tail_ = other.tail_;
+        size_ = other.size_;
         other.reset_();
         return *this;
     }
 
-    template <typename T>
-    auto operator=(std::span<T> span) -> self&
-    {
-        this->~Gulp();
-        data_ = iterator(span.data());
-        len_ = span.size_bytes();
-        read_ = 0;
-        write_ = len_;
-        cow_ = true;
-        return *this;
-    }
-
+    // copies the bytes, share() avoids the copy
     auto operator=(std::string_view view) -> self&
     {
-        return this->operator=(std::span<const char>(view));
+        clear();
+        if (!view.empty()) append(std::as_bytes(std::span(view)));
+        return *this;
     }
 
-    ~Gulp();
+    // the last owner, no other thread can hold it
+    ~Gulp() { release_all_(); }
 
-    auto data() { return begin_(); }
-    auto size() const -> size_t { return write_ - read_; }
-    auto capacity() const -> size_t { return len_ - read_; }
+    auto data() { return linear_(); }
+    auto size() const -> size_t { return size_; }
     auto empty() const -> bool { return size() == 0; }
+    // blocks held, at most one while the bytes are contiguous
+    auto blocks() const -> size_t { return blocks_.size(); }
 
     auto begin() const
     {
-        return const_cast<const_iterator>(const_cast<self*>(this)->begin_());
-    }
-    auto end() const
-    {
-        return const_cast<const_iterator>(const_cast<self*>(this)->end_());
+        return const_cast<const_iterator>(const_cast<self*>(this)->linear_());
     }
+    auto end() const { return begin() + size(); }
 
-    void clear() { read_ = write_ = 0; }
+    // returns every block
+    void clear();
 
-    void reserve(size_t sz);
+    // drops n bytes from the front, returning the blocks they used
+    void consume(size_t n);
 
     auto read(int fd) -> ssize_t;
 
     auto write(int fd) -> ssize_t;
 
-    void append(std::span<std::byte> span);
+    void append(std::span<std::byte const> span);
+
+    // appends bytes without copying them, owner is held until they are
+    // consumed; the aliasing shared_ptr constructor shares a part of a
+    // larger object
+    auto share(std::shared_ptr<void const> owner, std::span<std::byte const> bytes) -> self&;
+
+    // ends the ownership of the calling thread
+    void handoff()
+    {
+#ifndef NDEBUG
+        owner_ = std::thread::id();
+#endif
+    }
 
     auto view() -> std::string_view { return {(char const*)begin(), size()}; }
     auto span() -> std::span<std::byte const> { return {begin(), size()}; }
 
 private:
-    auto begin_() -> iterator { return data_ + read_; }
-    auto end_() -> iterator { return data_ + write_; }
+    struct Block {
+        iterator data;
+        size_t len;
+        enum Kind {
+            POOLED,
+            HEAP,   // a chain copied into one, larger than a block
+            SHARED, // kept alive by owner, never written
+        } kind;
+        std::shared_ptr<void const> owner;
+    };
+
+    // the bytes in one block, copying a chain if needed
+    auto linear_() -> iterator;
+
+    // room left in the last block
+    auto vacant_() const -> size_t
+    {
+        if (blocks_.empty() || blocks_.back().kind == Block::SHARED) return 0;
+        return blocks_.back().len - tail_;
+    }
+
+    static void release_(Block const& block);
+
+    void release_all_();
 
     void reset_();
 
-    iterator data_;
-    size_t len_;
-    std::atomic<size_t> read_;
-    std::atomic<size_t> write_;
-    std::atomic<bool> cow_;
+#ifdef NDEBUG
+    void check_() const { }
+#else
+    // adopts the Gulp for the calling thread if it has no owner
+    void check_() const;
+
+    mutable std::thread::id owner_;
+#endif
+
+    // every block but the last is full, head_ indexes the first and
+    // tail_ the last
+    std::vector<Block> blocks_;
+    size_t head_;
+    size_t tail_;
+    size_t size_;
 };
 
 class Slurp
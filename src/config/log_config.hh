@@ -49,7 +49,8 @@ struct convert<LogAppender::ptr> {
         auto& manager = LogManager::Instance();
 
         node["level"] = appender->Level();
-        node["format"] = manager.GetName(appender->Formatter());
+        if (appender->Formatter())
+            node["format"] = manager.GetName(appender->Formatter());
 
         return node;
     }
@@ -59,16 +60,31 @@ struct convert<LogAppender::ptr> {
         auto& manager = LogManager::Instance();
 
         auto level = node["level"].as<LogLevel>();
+        auto name = node["name"].as<std::string_view>();
+
+        // binary appenders keep arguments unformatted, see logcat
+        if (name.starts_with("binary")) {
+            size_t segment_size = 64 << 20;
+            if (auto n = node["segment_size"]) segment_size = n.as<size_t>();
+            appender = std::make_shared<BinaryLogAppender>(
+                level, node["filename"].as<std::string_view>(), segment_size);
+            return true;
+        }
+
         auto format = manager.GetFormatter(
             node["format"].as<std::string_view>());
-
-        auto name = node["name"].as<std::string_view>();
         if (name.starts_with("stdout")) {
             appender = std::make_shared<StdoutLogAppender>(
                 level, format);
         } else if (name.starts_with("file")) {
+            FileLogAppender::Options options;
+            if (auto n = node["buffer_size"]) options.buffer_size = n.as<size_t>();
+            if (auto n = node["flush_interval"]) options.flush_interval = n.as<int64_t>();
+            if (auto n = node["max_size"]) options.max_size = n.as<size_t>();
+            if (auto n = node["rotate_interval"]) options.rotate_interval = n.as<int64_t>();
+            if (auto n = node["compress"]) options.compress = n.as<bool>();
             appender = std::make_shared<FileLogAppender>(
-                level, format, node["filename"].as<std::string_view>());
+                level, format, node["filename"].as<std::string_view>(), options);
         } else return false;
         return true;
     }
@@ -129,6 +145,25 @@ auto LogInit(YAML::Node const& node) -> bool
         manager.AddLogger(logger);
     }
 
+    if (auto recorder = log["recorder"]) {
+        LogRecorder::Options options;
+        if (auto n = recorder["level"]) options.level = n.as<LogLevel>();
+        if (auto n = recorder["size"]) options.size = n.as<size_t>();
+        if (auto n = recorder["path"]) options.path = n.as<std::string>();
+        if (auto n = recorder["signals"]) options.signals = n.as<bool>();
+        LogRecorder::Install(options);
+    }
+
+    if (auto limit = log["limit"]) {
+        LogLimiter::Options options;
+        if (auto n = limit["level"]) options.level = n.as<LogLevel>();
+        if (auto n = limit["rate"]) options.rate = n.as<double>();
+        if (auto n = limit["burst"]) options.burst = n.as<uint32_t>();
+        if (auto n = limit["collapse"]) options.collapse = n.as<bool>();
+        if (auto n = limit["flush_interval"]) options.flush_interval = n.as<int64_t>();
+        LogLimiter::Instance().Configure(options);
+    }
+
     return true;
 }
 
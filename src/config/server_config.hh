@@ -14,13 +14,112 @@ struct convert<ThreadPool::ptr> {
     static Node encode(ThreadPool::ptr const& pool)
     {
         Node node;
+        auto const& options = pool->GetOptions();
         node["count"] = pool->Count();
+        node["discipline"] = options.discipline == ThreadPool::Discipline::ADAPTIVE ? "adaptive" : "fifo";
+        node["target"] = options.target;
+        node["interval"] = options.interval;
+        node["deadline"] = options.deadline;
         return node;
     }
     static bool decode(Node const& node, ThreadPool::ptr& pool)
     {
         if (!node.IsMap()) return false;
-        pool = ThreadPool::ptr(new ThreadPool(node["count"].as<size_t>()));
+        ThreadPool::Options options;
+        if (auto n = node["discipline"]) {
+            auto name = n.as<std::string_view>();
+            if (name == "fifo") options.discipline = ThreadPool::Discipline::FIFO;
+            else if (name == "adaptive") options.discipline = ThreadPool::Discipline::ADAPTIVE;
+            else return false;
+        }
+        if (auto n = node["target"]) options.target = n.as<int>();
+        if (auto n = node["interval"]) options.interval = n.as<int>();
+        if (auto n = node["deadline"]) options.deadline = n.as<int>();
+        pool = ThreadPool::ptr(new ThreadPool(node["count"].as<size_t>(), options));
+        return true;
+    }
+};
+
+template <>
+struct convert<SocketOptions> {
+    static bool decode(Node const& node, SocketOptions& options)
+    {
+        if (!node.IsMap()) return false;
+        auto get = [&node](char const* key, auto& value) {
+            if (auto n = node[key]) value = n.as<std::remove_reference_t<decltype(value)>>();
+        };
+        get("backlog", options.backlog);
+        get("nodelay", options.nodelay);
+        get("cork", options.cork);
+        get("notsent_lowat", options.notsent_lowat);
+        get("sndbuf", options.sndbuf);
+        get("rcvbuf", options.rcvbuf);
+        get("fastopen", options.fastopen);
+        get("defer_accept", options.defer_accept);
+        get("busy_poll", options.busy_poll);
+        return true;
+    }
+};
+
+template <>
+struct convert<AdmissionOptions> {
+    static bool decode(Node const& node, AdmissionOptions& options)
+    {
+        if (!node.IsMap()) return false;
+        auto get = [&node](char const* key, auto& value) {
+            if (auto n = node[key]) value = n.as<std::remove_reference_t<decltype(value)>>();
+        };
+        get("max_connections", options.max_connections);
+        get("queue_target", options.queue_target);
+        get("queue_interval", options.queue_interval);
+        get("max_memory", options.max_memory);
+        get("retry_after", options.retry_after);
+        return true;
+    }
+};
+
+template <>
+struct convert<ClientLimitOptions> {
+    static bool decode(Node const& node, ClientLimitOptions& options)
+    {
+        if (!node.IsMap()) return false;
+        auto get = [&node](char const* key, auto& value) {
+            if (auto n = node[key]) value = n.as<std::remove_reference_t<decltype(value)>>();
+        };
+        get("rate", options.rate);
+        get("burst", options.burst);
+        get("max_connections", options.max_connections);
+        get("idle", options.idle);
+        get("capacity", options.capacity);
+        get("retry_after", options.retry_after);
+        return true;
+    }
+};
+
+template <>
+struct convert<AccessLog::ptr> {
+    static bool decode(Node const& node, AccessLog::ptr& access_log)
+    {
+        if (!node.IsMap()) return false;
+        auto& manager = LogManager::Instance();
+
+        auto format = AccessLog::Format::COMBINED;
+        if (auto n = node["format"]) {
+            auto name = n.as<std::string_view>();
+            if (name == "common") format = AccessLog::Format::COMMON;
+            else if (name == "combined") format = AccessLog::Format::COMBINED;
+            else if (name == "json") format = AccessLog::Format::JSON;
+            else return false;
+        }
+        double sample = node["sample"] ? node["sample"].as<double>() : 1.0;
+        int64_t slow_ms = node["slow_ms"] ? node["slow_ms"].as<int64_t>() : 0;
+
+        access_log = std::make_shared<AccessLog>(format, sample, slow_ms);
+        for (auto& n : node["appenders"]) {
+            auto appender = manager.GetAppender(n.as<std::string_view>());
+            if (!appender) return false;
+            access_log->AddAppender(appender);
+        }
         return true;
     }
 };
@@ -40,10 +139,44 @@ auto ServerInit(YAML::Node const& node) -> bool
 
     auto timer = Timer::ptr(new Timer());
     auto thread_pool = server["thread"].as<ThreadPool::ptr>();
+    auto socket_options = server["socket"] ? server["socket"].as<SocketOptions>() : SocketOptions();
+    auto admission = server["admission"] ? server["admission"].as<AdmissionOptions>() : AdmissionOptions();
+    auto client_limit = server["client_limit"] ? server["client_limit"].as<ClientLimitOptions>() : ClientLimitOptions();
+
+    // log appenders are configured first, access_log refers to them
+    if (auto access_log = server["access_log"]) {
+        HttpConnection::access_log = access_log.as<AccessLog::ptr>();
+    }
+
+    if (auto trace = server["trace"]) {
+        if (!trace.IsMap()) return false;
+        HttpConnection::trace_path = trace["path"] ? trace["path"].as<std::string>() : "";
+        Tracer::Install(trace["size"] ? trace["size"].as<size_t>() : 65536);
+    }
+
+    if (auto cache = server["cache"]) {
+        if (!cache.IsMap()) return false;
+        size_t size = cache["size"] ? cache["size"].as<size_t>() : 0;
+        size_t max_file = cache["max_file"] ? cache["max_file"].as<size_t>() : size;
+        HttpResponse::file_cache = size ? std::make_shared<FileCache>(size, max_file) : nullptr;
+    }
+    HttpConnection::zerocopy_size = server["zerocopy"] ? server["zerocopy"].as<size_t>() : 0;
+
+    if (auto metrics = server["metrics"]) {
+        if (!metrics.IsMap()) return false;
+        HttpConnection::metrics_path = metrics["path"] ? metrics["path"].as<std::string>() : "";
+        int metrics_port = metrics["port"] ? metrics["port"].as<int>() : 0;
+        if (metrics_port && !Metrics::Instance().Serve(metrics_port)) return false;
+        if (auto shm = metrics["shm"]; shm && !shm.as<std::string>().empty() &&
+                                       !Metrics::Instance().Publish(shm.as<std::string>())) {
+            return false;
+        }
+        Metrics::Instance().Start(metrics["interval"] ? metrics["interval"].as<int64_t>() : 1000);
+    }
 
     InstanceManager::AddInstance<WebServer>(
         src_dir, port, trigger_mode, timeout, opt_linger,
-        std::move(timer), std::move(thread_pool));
+        std::move(timer), std::move(thread_pool), socket_options, admission, client_limit);
 
     return true;
 }
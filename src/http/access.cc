@@ -0,0 +1,152 @@
+#include "http.hh"
+
+namespace
+{
+// CLF time, e.g. 10/Oct/2000:13:55:36 +0000
+constexpr char const* clf_time_format = "%d/%b/%Y:%H:%M:%S %z";
+constexpr char const* iso_time_format = "%Y-%m-%dT%H:%M:%S";
+constexpr char const* iso_zone_format = "%z";
+
+auto Header(HttpRequest const& req, std::string_view key) -> std::string_view
+{
+    auto found = req.Header().find(key);
+    return found != req.Header().end() ? found->second : std::string_view();
+}
+
+void Millis(std::string& out, int64_t us)
+{
+    std::format_to(std::back_inserter(out), "{:.3f}", std::max(us, int64_t(0)) / 1000.0);
+}
+} // namespace
+
+AccessLog::AccessLog(Format format, double sample, int64_t slow_ms) :
+    format_(format),
+    sample_(std::clamp(sample, 0.0, 1.0)),
+    slow_us_(slow_ms * 1000),
+    logger_(LogLevel::INFO, "access") { }
+
+void AccessLog::AddAppender(LogAppender::ptr appender)
+{
+    logger_.AddAppender(appender);
+}
+
+void AccessLog::Record(HttpConnection const& conn, Timing const& timing)
+{
+    if (!Sampled_(timing)) return;
+
+    thread_local std::string line;
+    line.clear();
+
+    auto const now = LogClock::NowMs();
+    if (format_ == Format::JSON) Json_(line, conn, timing, now);
+    else {
+        Common_(line, conn, now);
+        // nginx style extra fields, ignored by CLF parsers; rt is timed
+        // from the request read, idle is the keep-alive wait before it
+        line.append(" rt=");
+        Millis(line, timing.written - timing.read);
+        line.append(" idle=");
+        Millis(line, timing.read - timing.start);
+        line.append(" parse=");
+        Millis(line, timing.parsed - timing.read);
+        line.append(" compose=");
+        Millis(line, timing.composed - timing.parsed);
+        line.append(" write=");
+        Millis(line, timing.written - timing.composed);
+    }
+
+    LogEvent event("", "", 0, LogEvent::CurrentThreadId(), Fiber::GetId(),
+                   now - LogManager::Instance().StartTime(), now, line);
+    logger_.Log(LogLevel::INFO, event);
+}
+
+auto AccessLog::Sampled_(Timing const& timing) const -> bool
+{
+    if (sample_ >= 1.0 || timing.written - timing.read >= slow_us_) return true;
+    if (sample_ <= 0.0) return false;
+
+    thread_local std::minstd_rand engine(std::random_device {}());
+    return std::uniform_real_distribution<double>()(engine) < sample_;
+}
+
+void AccessLog::Common_(std::string& out, HttpConnection const& conn, int64_t now)
+{
+    auto const& req = conn.Request();
+
+    char ip[INET_ADDRSTRLEN];
+    out.append(::inet_ntop(AF_INET, &conn.Addr().sin_addr, ip, sizeof(ip)));
+    out.append(" - - [");
+    LogTimeCache::Format(out, now, clf_time_format, false);
+    out.append("] \"");
+    Escape_(out, req.Method(), false);
+    out.push_back(' ');
+    Escape_(out, req.Path(), false);
+    out.push_back(' ');
+    Escape_(out, req.Version(), false);
+    std::format_to(std::back_inserter(out), "\" {} ", int(conn.Code()));
+    if (conn.ResponseBytes()) std::format_to(std::back_inserter(out), "{}", conn.ResponseBytes());
+    else out.push_back('-');
+
+    if (format_ == Format::COMBINED) {
+        auto referer = Header(req, "Referer");
+        auto user_agent = Header(req, "User-Agent");
+        out.append(" \"");
+        Escape_(out, referer.empty() ? "-" : referer, false);
+        out.append("\" \"");
+        Escape_(out, user_agent.empty() ? "-" : user_agent, false);
+        out.push_back('"');
+    }
+}
+
+void AccessLog::Json_(std::string& out, HttpConnection const& conn,
+                      Timing const& timing, int64_t now)
+{
+    auto const& req = conn.Request();
+
+    char ip[INET_ADDRSTRLEN];
+    out.append("{\"time\":\"");
+    LogTimeCache::Format(out, now, iso_time_format, true);
+    LogTimeCache::Format(out, now, iso_zone_format, false);
+    out.append("\",\"remote\":\"");
+    out.append(::inet_ntop(AF_INET, &conn.Addr().sin_addr, ip, sizeof(ip)));
+    out.append("\",\"method\":\"");
+    Escape_(out, req.Method(), true);
+    out.append("\",\"path\":\"");
+    Escape_(out, req.Path(), true);
+    out.append("\",\"version\":\"");
+    Escape_(out, req.Version(), true);
+    std::format_to(std::back_inserter(out), "\",\"status\":{},\"bytes\":{}",
+                   int(conn.Code()), conn.ResponseBytes());
+    out.append(",\"referer\":\"");
+    Escape_(out, Header(req, "Referer"), true);
+    out.append("\",\"user_agent\":\"");
+    Escape_(out, Header(req, "User-Agent"), true);
+    out.append("\",\"ms\":{\"total\":");
+    Millis(out, timing.written - timing.read);
+    out.append(",\"idle\":");
+    Millis(out, timing.read - timing.start);
+    out.append(",\"parse\":");
+    Millis(out, timing.parsed - timing.read);
+    out.append(",\"compose\":");
+    Millis(out, timing.composed - timing.parsed);
+    out.append(",\"write\":");
+    Millis(out, timing.written - timing.composed);
+    out.append("}}");
+}
+
+// quotes, backslashes and control characters come from the client,
+// escaped as \xHH in text lines and \uHHHH in JSON
+void AccessLog::Escape_(std::string& out, std::string_view s, bool json)
+{
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if ((unsigned char)c < 0x20 || c == 0x7f) {
+            if (json) std::format_to(std::back_inserter(out), "\\u{:04x}", int(c));
+            else std::format_to(std::back_inserter(out), "\\x{:02x}", int(c));
+        } else {
+            out.push_back(c);
+        }
+    }
+}
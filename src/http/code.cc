@@ -1,9 +1,10 @@
 #include "http.hh"
 
 const std::unordered_map<int, std::string_view> HttpCode::code_name {
-    {Unknown,     "Unknown"    },
-    {OK,          "OK"         },
-    {Bad_Request, "Bad Request"},
-    {Forbidden,   "Forbidden"  },
-    {Not_Found,   "Not Found"  },
+    {Unknown,           "Unknown"          },
+    {OK,                "OK"               },
+    {Bad_Request,       "Bad Request"      },
+    {Forbidden,         "Forbidden"        },
+    {Not_Found,         "Not Found"        },
+    {Too_Many_Requests, "Too Many Requests"},
 };
\ No newline at end of file
@@ -1,16 +1,63 @@
 #include "http.hh"
 #include "utils.hh"
 
+#include <deque>
+
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
+
 bool HttpConnection::et;
+bool HttpConnection::cork;
 std::filesystem::path HttpConnection::base_;
 std::atomic<int> HttpConnection::user_count;
+AccessLog::ptr HttpConnection::access_log;
+std::string HttpConnection::metrics_path;
+std::string HttpConnection::trace_path;
+size_t HttpConnection::zerocopy_size;
+std::function<bool(::in_addr_t)> HttpConnection::admit;
+std::string_view HttpConnection::refusal;
+
+namespace
+{
+CounterVec requests("http_requests_total", "Responses written, by status code.", "code", 600);
+Counter received("http_received_bytes_total", "Request bytes read.");
+Counter sent("http_sent_bytes_total", "Response bytes written.");
+Gauge connections("http_connections", "Open connections.");
+Histogram duration("http_request_duration_seconds",
+                   "Time from the request read to the response written.", 1e-6);
+
+Counter zerocopy_sends("http_zerocopy_sends_total", "Sends made with MSG_ZEROCOPY.");
+Counter zerocopy_copied("http_zerocopy_copied_total", "Zerocopy sends the kernel copied anyway.");
+
+std::atomic<uint64_t> request_ids;
+
+// the address for logs, formatted into buf instead of a string
+auto Dotted(::sockaddr_in const& addr, char (&buf)[INET_ADDRSTRLEN]) -> char const*
+{
+    return ::inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf));
+}
+
+// pins of zerocopy sends in flight when their socket closed, kept for
+// a grace period as the completions can no longer be read
+constexpr int64_t linger_us = 60 * 1000000;
+std::mutex lingering_mtx;
+std::deque<std::pair<int64_t, std::shared_ptr<void const>>> lingering;
+} // namespace
 
 HttpConnection::HttpConnection(int fd, ::sockaddr_in const& addr) :
-    fd_(fd), addr_(addr)
+    fd_(fd), closed_(false), refused_(false), keep_alive_(false), addr_(addr),
+    arena_(arena_buffer_, sizeof(arena_buffer_)), req_(&arena_), res_(&arena_),
+    zerocopy_(false), zerocopy_next_(0), zerocopy_done_(0),
+    res_bytes_(0), request_id_(0)
 {
+    if (zerocopy_size) {
+        int one = 1;
+        zerocopy_ = ::setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
     ++user_count;
-    LOG_INFO("create connection " + std::to_string(fd) +
-             " " + ::inet_ntoa(addr.sin_addr));
+    connections.Add();
+    timing_.start = AccessLog::Now();
+    LOG_INFO("create connection {} {}", fd, ::inet_ntoa(addr.sin_addr));
 }
 
 HttpConnection::~HttpConnection()
@@ -20,33 +67,70 @@ HttpConnection::~HttpConnection()
 
 auto HttpConnection::Read() -> ssize_t
 {
-    LOG_INFO("read from ip: " + Ip() + ':' + std::to_string(Port()));
+    [[maybe_unused]] char ip[INET_ADDRSTRLEN];
+    LOG_DEBUG("read from ip: {}:{}", Dotted(addr_, ip), Port());
 
     ssize_t total_len = 0;
     ssize_t len;
     do {
         len = gulp_.read(fd_);
-        if (len < 0) return len;
+        if (len < 0) break;
         total_len += len;
     } while (len && et);
 
+    // edge triggered reads end with EAGAIN after the data
+    if (total_len) {
+        received.Add(total_len);
+        if (!timing_.read) timing_.read = AccessLog::Now();
+        TRACE_PROBE(read, fd_, total_len);
+    }
+    // what the edge triggered loop read counts, not its final EAGAIN
+    if (len < 0 && !(total_len && ~len == EAGAIN)) return len;
+
     LOG_DEBUG("read done");
     return total_len;
 }
 
 auto HttpConnection::Write() -> ssize_t
 {
-    LOG_INFO("write to ip: " + Ip() + ':' + std::to_string(Port()));
+    [[maybe_unused]] char ip[INET_ADDRSTRLEN];
+    LOG_DEBUG("write to ip: {}:{}", Dotted(addr_, ip), Port());
 
     ssize_t total_len = 0;
+    if (cork && ToWriteBytes() == res_bytes_ && res_bytes_) SetCork_(true);
     do {
         ::iovec iov[] {
             {.iov_base = res_view_.data(),  .iov_len = res_view_.size() },
             {.iov_base = file_view_.data(), .iov_len = file_view_.size()},
         };
+        ::msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = sizeof(iov) / sizeof(iov[0]);
+        int flags = 0;
+        // a pinned body goes without a copy, the header before it lives
+        // in the arena and is copied
+        if (pin_ && !res_view_.empty()) {
+            msg.msg_iovlen = 1;
+            flags = MSG_MORE;
+        } else if (pin_) {
+            msg.msg_iov = iov + 1;
+            msg.msg_iovlen = 1;
+            flags = MSG_ZEROCOPY;
+        }
 
-        ssize_t len = ::writev(fd_, iov, sizeof(iov) / sizeof(iov[0]));
+        ssize_t len = ::sendmsg(fd_, &msg, flags);
+        if (len < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+            // no option memory left for the notification, copy the rest
+            pin_.reset();
+            flags = 0;
+            len = ::sendmsg(fd_, &msg, flags);
+        }
         if (len < 0) return ~errno;
+        if (flags & MSG_ZEROCOPY) Pin_(zerocopy_next_++);
+        if (!timing_.first_write) {
+            timing_.first_write = AccessLog::Now();
+            TRACE_PROBE(write_first, fd_, len);
+        }
         if (size_t(len) > res_view_.size()) {
             len -= res_view_.size();
             res_view_ = res_view_.subspan(res_view_.size());
@@ -57,26 +141,75 @@ auto HttpConnection::Write() -> ssize_t
         total_len += len;
     } while (ToWriteBytes() != 0 && (et || ToWriteBytes() > SWND_SIZE));
 
+    if (ToWriteBytes() == 0 && res_bytes_) {
+        LOG_DEBUG("response {} {} {} bytes", int(res_.Code()), req_.Path(), res_bytes_);
+        timing_.written = AccessLog::Now();
+        TRACE_PROBE(write_last, fd_, res_bytes_);
+        if (cork) SetCork_(false);
+        requests.With(int(res_.Code())).Add();
+        sent.Add(res_bytes_);
+        duration.Record(timing_.written - timing_.read);
+        if (access_log) access_log->Record(*this, timing_);
+        Trace_();
+        // the next request on a kept-alive connection starts now
+        timing_ = {.start = timing_.written};
+        res_bytes_ = 0;
+        pin_.reset();
+        // an idle connection holds neither the request blocks nor the
+        // arena, pipelined lines keep both
+        res_.Clear();
+        if (req_.Clear()) arena_.release();
+    }
+
     LOG_DEBUG("write done");
     return total_len;
 }
 
-void HttpConnection::Close()
+auto HttpConnection::Close() -> bool
 {
-    if (!closed_) {
-        ::close(fd_);
-        closed_ = true;
-        --user_count;
+    // the timer and a pool thread may both close, one of them does
+    if (closed_.exchange(true, std::memory_order_acq_rel)) return false;
+    if (!zerocopy_pins_.empty()) {
+        Complete();
+        auto now = AccessLog::Now();
+        std::lock_guard lock(lingering_mtx);
+        while (!lingering.empty() && lingering.front().first < now) lingering.pop_front();
+        for (auto& [id, pin] : zerocopy_pins_) lingering.emplace_back(now + linger_us, std::move(pin));
+        zerocopy_pins_.clear();
     }
+    ::close(fd_);
+    --user_count;
+    connections.Sub();
+    TRACE_PROBE(close, fd_);
+    return true;
 }
 
 auto HttpConnection::Process() -> bool
 {
-    req_.Clear();
+    // request and response were cleared when the last response was written
     if (gulp_.empty() && req_.Lines().empty()) return false;
     bool parse_result = gulp_.empty() ? req_.Parse()
                                       : req_.Parse(std::move(gulp_));
-    if (parse_result) {
+    timing_.parsed = AccessLog::Now();
+    request_id_ = request_ids.fetch_add(1, std::memory_order_relaxed) + 1;
+    TRACE_PROBE(parse, fd_, request_id_, int(parse_result));
+    // pipelined requests were read along with an earlier one
+    if (!timing_.read) timing_.read = timing_.start;
+    refused_ = admit && !admit(addr_.sin_addr.s_addr);
+    keep_alive_ = !refused_ && req_.IsKeepAlive();
+    if (refused_) {
+        res_.InitComposed(HttpCode::Too_Many_Requests);
+        [[maybe_unused]] char ip[INET_ADDRSTRLEN];
+        LOG_WARN("Too Many Requests from {}", Dotted(addr_, ip));
+    } else if (parse_result && !metrics_path.empty() && req_.Path() == metrics_path) {
+        res_.InitBody(Metrics::Instance().Snapshot(), Metrics::content_type,
+                      req_.IsKeepAlive());
+    } else if (parse_result && !trace_path.empty() && req_.Path() == trace_path &&
+               Tracer::Active()) {
+        auto body = std::make_shared<std::string>();
+        Tracer::Active()->Export(*body);
+        res_.InitBody(std::move(body), Tracer::content_type, req_.IsKeepAlive());
+    } else if (parse_result) {
         res_.Init(base_.native(), req_.Path(),
                   HttpCode::OK, req_.IsKeepAlive());
     } else {
@@ -84,22 +217,113 @@ auto HttpConnection::Process() -> bool
                   HttpCode::Bad_Request, false);
     }
 
-    res_.Compose();
-    res_view_ = res_.Response();
-    file_view_ = res_.FileSpan();
+    if (refused_) {
+        // only read from, like every response
+        res_view_ = {const_cast<char*>(refusal.data()), refusal.size()};
+        file_view_ = {};
+    } else {
+        res_.Compose();
+        res_view_ = res_.Response();
+        file_view_ = res_.FileSpan();
+    }
+    res_bytes_ = ToWriteBytes();
+    pin_.reset();
+    if (zerocopy_ && file_view_.size() >= zerocopy_size) pin_ = res_.Pin();
+    timing_.composed = AccessLog::Now();
+    TRACE_PROBE(compose, fd_, int(res_.Code()), res_bytes_);
 
-    LOG_DEBUG("res_view_.size: " + std::to_string(res_view_.size()) +
-              " file_view_.size: " + std::to_string(file_view_.size()));
+    LOG_DEBUG("res_view_.size: {} file_view_.size: {}",
+              res_view_.size(), file_view_.size());
 
     return true;
 }
 
+// one span for the request and one per stage, in the lane of the fd
+void HttpConnection::Trace_()
+{
+    auto* tracer = Tracer::Active();
+    if (!tracer) return;
+
+    auto const& t = timing_;
+    int code = int(res_.Code());
+    tracer->Span("request", fd_, request_id_, t.read, t.written, code);
+    tracer->Span("idle", fd_, request_id_, t.start, t.read);
+    tracer->Span("parse", fd_, request_id_, t.read, t.parsed);
+    tracer->Span("compose", fd_, request_id_, t.parsed, t.composed);
+    tracer->Span("write", fd_, request_id_, t.composed, t.written);
+}
+
 auto HttpConnection::ToWriteBytes() -> size_t
 {
     return res_view_.size() + file_view_.size();
 }
 
+auto HttpConnection::Complete() -> ssize_t
+{
+    while (true) {
+        alignas(::cmsghdr) char control[128];
+        ::msghdr msg {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return ~errno;
+        }
+        for (auto* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            ::sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            // sends ee_info to ee_data are done, in order on a stream
+            zerocopy_done_ = err.ee_data + 1;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // loopback and devices without scatter gather copy,
+                // pinning only costs then
+                zerocopy_copied.Add(err.ee_data - err.ee_info + 1);
+                zerocopy_ = false;
+            }
+        }
+    }
+    std::erase_if(zerocopy_pins_, [this](auto const& pin) {
+        return int32_t(pin.first - zerocopy_done_) < 0;
+    });
+
+    int error = 0;
+    ::socklen_t len = sizeof(error);
+    if (::getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) return ~errno;
+    return error ? ~error : 0;
+}
+
+void HttpConnection::SetCork_(bool on)
+{
+    // uncorking sends the partial frame left
+    int value = on;
+    if (::setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) < 0) {
+        LOG_WARN("TCP_CORK on {}: {}", fd_, error_message(errno).value());
+    }
+}
+
+void HttpConnection::Pin_(uint32_t id)
+{
+    zerocopy_sends.Add();
+    // one entry per body, for its last send
+    if (!zerocopy_pins_.empty() && zerocopy_pins_.back().second == pin_) {
+        zerocopy_pins_.back().first = id;
+    } else {
+        zerocopy_pins_.emplace_back(id, pin_);
+    }
+}
+
+void HttpConnection::Handoff()
+{
+    gulp_.handoff();
+    req_.Handoff();
+}
+
 auto HttpConnection::IsKeepAlive() const -> bool
 {
-    return req_.IsKeepAlive();
+    return keep_alive_;
 }
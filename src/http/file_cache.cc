@@ -0,0 +1,66 @@
+#include "http.hh"
+
+namespace
+{
+Counter hits("http_file_cache_hits_total", "Files served from the cache.");
+Counter misses("http_file_cache_misses_total", "Cacheable files read from disk.");
+Gauge cached("http_file_cache_bytes", "Bytes of files in the cache.");
+} // namespace
+
+FileCache::FileCache(size_t capacity, size_t max_file) :
+    capacity_(capacity), max_file_(std::min(max_file, capacity)), size_(0) { }
+
+auto FileCache::Get(std::string_view path) -> file_t
+{
+    assert(*path.end() == '\0');
+    struct ::stat st;
+    if (::stat(path.data(), &st) < 0 || !S_ISREG(st.st_mode) ||
+        size_t(st.st_size) > max_file_) {
+        return nullptr;
+    }
+    auto same = [&st](Entry const& entry) {
+        return entry.ino == st.st_ino && entry.file->size() == size_t(st.st_size) &&
+               entry.mtime.tv_sec == st.st_mtim.tv_sec &&
+               entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+    };
+
+    {
+        std::lock_guard lock(mtx_);
+        if (auto found = map_.find(path); found != map_.end() && same(*found->second)) {
+            lru_.splice(lru_.begin(), lru_, found->second);
+            hits.Add();
+            return found->second->file;
+        }
+    }
+
+    // read without the lock, a concurrent miss of the same file reads
+    // it twice and the later one replaces the entry
+    misses.Add();
+    auto file = std::make_shared<Slurp const>(path);
+    if (file->error_message()) return file;
+
+    std::lock_guard lock(mtx_);
+    int64_t before = size_;
+    if (auto found = map_.find(path); found != map_.end()) {
+        size_ -= found->second->file->size();
+        lru_.erase(found->second);
+        map_.erase(found);
+    }
+    lru_.push_front({std::string(path), st.st_mtim, st.st_ino, file});
+    map_.emplace(lru_.front().path, lru_.begin());
+    size_ += file->size();
+    while (size_ > capacity_) {
+        auto& last = lru_.back();
+        size_ -= last.file->size();
+        map_.erase(last.path);
+        lru_.pop_back();
+    }
+    cached.Add(int64_t(size_) - before);
+    return file;
+}
+
+auto FileCache::Size() const -> size_t
+{
+    std::lock_guard lock(mtx_);
+    return size_;
+}
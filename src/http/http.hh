@@ -3,7 +3,11 @@
 
 #include <filesystem>
 #include <functional>
+#include <list>
 #include <map>
+#include <memory_resource>
+#include <mutex>
+#include <random>
 #include <regex>
 #include <set>
 #include <sstream>
@@ -17,6 +21,8 @@
 #include "buffer/buffer.hh"
 #include "log/log.hh"
 #include "magic_enum.hh"
+#include "metrics/metrics.hh"
+#include "trace/trace.hh"
 
 class HttpCode
 {
@@ -27,6 +33,7 @@ public:
         Bad_Request = 400,
         Forbidden = 403,
         Not_Found = 404,
+        Too_Many_Requests = 429,
     };
 
 private:
@@ -60,14 +67,21 @@ public:
         FINISH,
     };
 
-    HttpRequest() :
+    // every container allocates from resource
+    explicit HttpRequest(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        resource_(resource), lines_(resource),
         state_(ParseState::REQUEST_LINE),
-        method_(), version_(), body_(), path_(), header_() { }
+        method_(), version_(), body_(), path_(resource), header_(resource) { }
 
-    void Clear();
+    // true once nothing allocated from the resource is in use, so it
+    // can be reset; pipelined lines keep it
+    auto Clear() -> bool;
 
     auto Parse() -> bool { return Parse_(); }
 
+    // before another thread takes the request over
+    void Handoff() { raw_data_.handoff(); }
+
     template <typename U>
     auto Parse(U&& data) -> bool
     {
@@ -78,8 +92,7 @@ public:
         return Parse_();
     }
 
-    auto& Path() { return path_; }
-    auto const& Path() const { return path_; }
+    auto Path() const -> std::string_view { return path_; }
     auto const& Method() const { return method_; }
     auto const& Version() const { return version_; }
     auto const& Header() const { return header_; }
@@ -92,7 +105,7 @@ private:
     auto Parse_() -> bool;
 
     auto SliceLines_(std::string_view view)
-        -> std::list<std::string_view>;
+        -> std::pmr::list<std::string_view>;
 
     auto ParseRequestLine_(std::string_view& line) -> bool;
 
@@ -107,26 +120,79 @@ private:
         // TODO
     }
 
+    std::pmr::memory_resource* resource_;
     Gulp raw_data_;
-    std::list<std::string_view> lines_;
+    std::pmr::list<std::string_view> lines_;
     ParseState state_;
     std::string_view method_, version_, body_;
-    std::string path_;
-    std::unordered_map<std::string_view, std::string_view> header_;
+    std::pmr::string path_;
+    std::pmr::unordered_map<std::string_view, std::string_view> header_;
 
     static const std::unordered_set<std::string_view> default_html;
 };
 
+// Files kept in memory between requests. A hit is checked against
+// stat, so a file changed on disk is read again. Past the capacity the
+// least recently used entries are dropped; responses hold an entry by
+// shared_ptr, so a dropped one lives until they are written.
+class FileCache
+{
+public:
+    typedef FileCache self;
+    typedef std::shared_ptr<self> ptr;
+    typedef std::shared_ptr<Slurp const> file_t;
+
+    // files larger than max_file are not kept
+    FileCache(size_t capacity, size_t max_file);
+
+    // the file read, from memory when unchanged; null when it is not
+    // a cacheable regular file, the caller reads it then
+    auto Get(std::string_view path) -> file_t;
+
+    auto Size() const -> size_t;
+
+private:
+    struct Entry {
+        std::string path;
+        ::timespec mtime;
+        ::ino_t ino;
+        file_t file;
+    };
+
+    size_t capacity_, max_file_;
+
+    mutable std::mutex mtx_;
+    size_t size_;
+    // most recent first, the map keys view the entry paths
+    std::list<Entry> lru_;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> map_;
+};
+
 class HttpResponse
 {
 public:
-    HttpResponse() = default;
+    // every container allocates from resource
+    explicit HttpResponse(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        resource_(resource), res_lst_(resource), temp_(resource), response_(resource),
+        base_(resource), full_path_(resource), code_(), keep_alive_(false) { }
 
     ~HttpResponse() = default;
 
+    // drops everything allocated from the resource, the response must
+    // be written
+    void Clear();
+
     void Init(std::string_view base, std::string_view path,
               HttpCode code = HttpCode::Unknown, bool keep_alive = false);
 
+    // a 200 with a body composed elsewhere instead of a file
+    void InitBody(std::shared_ptr<std::string const> body,
+                  std::string_view type, bool keep_alive);
+
+    // a response composed elsewhere, only its code is kept; not to be
+    // composed
+    void InitComposed(HttpCode code);
+
     void Compose();
 
     auto& Response() { return response_; }
@@ -134,18 +200,38 @@ public:
 
     int ErrorNo() const
     {
-        return slurp_.error_message() ? slurp_.errer_no() : 0;
+        return File_().error_message() ? File_().errer_no() : 0;
     }
 
-    auto const& ErrorMessage() const { return slurp_.error_message(); }
+    auto const& ErrorMessage() const { return File_().error_message(); }
 
-    auto FileView() -> std::string_view { return slurp_.view(); }
+    auto FileView() -> std::string_view
+    {
+        return body_ ? std::string_view(*body_) : File_().view();
+    }
     auto FileSpan() -> std::span<char>
     {
-        return {(char*)slurp_.span().data(), slurp_.span().size()};
+        if (body_) return {(char*)body_->data(), body_->size()};
+        return {(char*)File_().span().data(), File_().span().size()};
     }
 
+    // keeps the body alive beyond the response, null when the body is
+    // the response's own copy of the file
+    auto Pin() const -> std::shared_ptr<void const>
+    {
+        if (body_) return body_;
+        return file_;
+    }
+
+    // null when files are read for every request
+    static FileCache::ptr file_cache;
+
 private:
+    auto File_() const -> Slurp const& { return file_ ? *file_ : slurp_; }
+
+    // the file at path, from the cache when there is one
+    void Read_(std::string_view path);
+
     void ComposeCode_();
 
     void Redirect_();
@@ -160,12 +246,22 @@ private:
 
     auto FileType_() -> std::string_view;
 
-    std::list<std::string_view> res_lst_;
-    std::list<std::string> temp_;
-    std::string response_;
+    // n formatted into temp_
+    auto Number_(size_t n) -> std::string_view;
 
-    std::filesystem::path base_, full_path_;
+    // base_ joined with the path, without its leading slashes
+    void Join_(std::pmr::string& out, std::string_view path);
+
+    std::pmr::memory_resource* resource_;
+    std::pmr::list<std::string_view> res_lst_;
+    std::pmr::list<std::pmr::string> temp_;
+    std::pmr::string response_;
+
+    std::pmr::string base_, full_path_;
     Slurp slurp_;
+    FileCache::file_t file_;
+    std::shared_ptr<std::string const> body_;
+    std::string_view body_type_;
 
     HttpCode code_;
     bool keep_alive_;
@@ -175,9 +271,68 @@ private:
     static const std::unordered_map<int, std::string_view> code_path;
 };
 
+class HttpConnection;
+
+// One line per response in Common, Combined or JSON format, with the
+// time spent in each stage of the request. Lines go to the appenders
+// of a private logger, so a buffered FileLogAppender keeps the disk
+// off the request path. Requests are sampled, slow ones always logged.
+class AccessLog
+{
+public:
+    typedef AccessLog self;
+    typedef std::shared_ptr<self> ptr;
+
+    enum class Format {
+        COMMON,
+        COMBINED,
+        JSON,
+    };
+
+    // CLOCK_MONOTONIC microseconds at each stage of a request
+    struct Timing {
+        int64_t start = 0; // accepted, or the previous response written
+        int64_t read = 0;  // first bytes of the request read; the request
+                           // is timed from here, before it the client idles
+        int64_t parsed = 0;
+        int64_t composed = 0;
+        int64_t first_write = 0; // first bytes of the response written
+        int64_t written = 0;     // last byte of the response written
+    };
+
+    AccessLog(Format format, double sample, int64_t slow_ms);
+
+    void AddAppender(LogAppender::ptr appender);
+
+    void Record(HttpConnection const& conn, Timing const& timing);
+
+    static auto Now() -> int64_t
+    {
+        ::timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+private:
+    auto Sampled_(Timing const& timing) const -> bool;
+
+    void Common_(std::string& out, HttpConnection const& conn, int64_t now);
+    void Json_(std::string& out, HttpConnection const& conn,
+               Timing const& timing, int64_t now);
+
+    static void Escape_(std::string& out, std::string_view s, bool json);
+
+    Format format_;
+    double sample_;
+    int64_t slow_us_;
+    Logger logger_;
+};
+
 class HttpConnection
 {
     static constexpr size_t SWND_SIZE = 10240;
+    // holds a request and its response with common headers
+    static constexpr size_t ARENA_SIZE = 4096;
 
 public:
     typedef HttpConnection self;
@@ -196,29 +351,87 @@ public:
 
     auto Write() -> ssize_t;
 
-    void Close();
+    // false when it was closed already; of racing callers (the timer
+    // and a pool thread) only one closes
+    auto Close() -> bool;
 
     auto Process() -> bool;
 
     auto ToWriteBytes() -> size_t;
 
+    // of the last request, false after a refused one; kept once the
+    // request is cleared
     auto IsKeepAlive() const -> bool;
 
+    // ends the ownership of the calling pool thread, before the
+    // connection is re-armed and another one may pick it up
+    void Handoff();
+
+    // takes zerocopy completions off the error queue, dropping the
+    // pins of finished sends; < 0 on a socket error
+    auto Complete() -> ssize_t;
+
+    // cleared once the response is written
+    auto const& Request() const { return req_; }
+    auto Code() const { return res_.Code(); }
+    // of the response being written
+    auto ResponseBytes() const { return res_bytes_; }
+
 private:
     int fd_;
-    bool closed_;
+    std::atomic<bool> closed_;
+    // the last request was refused by admit
+    bool refused_;
+    bool keep_alive_;
     ::sockaddr_in addr_;
 
     Gulp gulp_;
+    // request and response memory, released at once between requests
+    alignas(std::max_align_t) std::byte arena_buffer_[ARENA_SIZE];
+    std::pmr::monotonic_buffer_resource arena_;
     HttpRequest req_;
 
     std::span<char> res_view_, file_view_;
     HttpResponse res_;
 
+    void Trace_();
+
+    void SetCork_(bool on);
+
+    // holds the body until the send numbered id completes
+    void Pin_(uint32_t id);
+
+    // the body of the response being written when sent without a copy
+    std::shared_ptr<void const> pin_;
+    // SO_ZEROCOPY is set and the kernel has not been seen copying
+    bool zerocopy_;
+    // the kernel numbers the zerocopy sends of a socket from 0
+    uint32_t zerocopy_next_, zerocopy_done_;
+    std::vector<std::pair<uint32_t, std::shared_ptr<void const>>> zerocopy_pins_;
+
+    AccessLog::Timing timing_;
+    size_t res_bytes_;
+    uint64_t request_id_;
+
 public:
     static bool et;
+    // TCP_CORK from the first byte of a response to the last
+    static bool cork;
     static std::filesystem::path base_;
     static std::atomic<int> user_count;
+    // null when access logging is off
+    static AccessLog::ptr access_log;
+    // served from the metrics snapshot, empty when off
+    static std::string metrics_path;
+    // serves the spans of the tracer, empty when off
+    static std::string trace_path;
+    // bodies of at least this many bytes, pinned by the file cache,
+    // go out with MSG_ZEROCOPY; 0 for never
+    static size_t zerocopy_size;
+    // asked with the client IP once per parsed request; a refused one
+    // is answered with refusal and the connection closes. Empty when off
+    static std::function<bool(::in_addr_t)> admit;
+    static std::string_view refusal;
 };
 
 #endif // __HTTP__H_
\ No newline at end of file
@@ -9,12 +9,22 @@ const std::unordered_set<std::string_view> HttpRequest::default_html {
     "/picture",
 };
 
-void HttpRequest::Clear()
+auto HttpRequest::Clear() -> bool
 {
     state_ = ParseState::REQUEST_LINE;
-    path_.clear();
-    header_.clear();
     method_ = version_ = body_ = std::string_view();
+    if (!lines_.empty()) {
+        path_.clear();
+        header_.clear();
+        return false;
+    }
+    // the blocks go back to the pool, and the containers are swapped
+    // with fresh ones that keep nothing in the resource (a string moved
+    // into keeps its buffer)
+    raw_data_.clear();
+    std::pmr::string(resource_).swap(path_);
+    decltype(header_)(resource_).swap(header_);
+    return true;
 }
 
 auto HttpRequest::IsKeepAlive() const -> bool
@@ -51,11 +61,11 @@ auto HttpRequest::Parse_() -> bool
 }
 
 auto HttpRequest::SliceLines_(std::string_view view)
-    -> std::list<std::string_view>
+    -> std::pmr::list<std::string_view>
 {
     constexpr std::string_view CRLF {"\r\n"};
 
-    std::list<std::string_view> lines;
+    std::pmr::list<std::string_view> lines(resource_);
     while (true) {
         if (view.starts_with(CRLF)) {
             lines.emplace_back("");
@@ -95,14 +105,13 @@ auto HttpRequest::ParseRequestLine_(std::string_view& line) -> bool
 
         state_ = ParseState::HEADERS;
 
-        LOG_DEBUG("[method: " + std::string(method_) + "] " +
-                  "[path: " + path_ + "] " +
-                  "[version: " + std::string(version_) + "] ");
+        LOG_DEBUG("[method: {}] [path: {}] [version: {}] ",
+                  method_, path_, version_);
         return true;
 
     } while (0);
 
-    LOG_ERROR("fail to parse request line:" + std::string(line));
+    LOG_ERROR("fail to parse request line:{}", line);
     return false;
 }
 
@@ -127,7 +136,7 @@ void HttpRequest::ParseBody_(std::string_view& line)
     body_ = line;
     ParsePost_();
     state_ = ParseState::FINISH;
-    LOG_DEBUG("BODY: " + std::string(body_));
+    LOG_DEBUG("BODY: {}", body_);
 }
 
 void HttpRequest::ParsePath_()
@@ -1,5 +1,9 @@
 #include "http.hh"
 
+#include <charconv>
+
+FileCache::ptr HttpResponse::file_cache;
+
 const std::unordered_map<std::string_view, std::string_view> HttpResponse::suffix_type = {
     {".html",  "text/html"            },
     {".xml",   "text/xml"             },
@@ -31,21 +35,56 @@ const std::unordered_map<int, std::string_view> HttpResponse::code_path = {
 
 void HttpResponse::Init(std::string_view base, std::string_view path, HttpCode code, bool keep_alive)
 {
-    base_ = base;
-    full_path_ = base_ / std::filesystem::path(path).relative_path();
+    base_.assign(base);
+    Join_(full_path_, path);
 
     code_ = code;
     keep_alive_ = keep_alive;
+    body_.reset();
+}
+
+void HttpResponse::InitBody(std::shared_ptr<std::string const> body,
+                            std::string_view type, bool keep_alive)
+{
+    body_ = std::move(body);
+    body_type_ = type;
+    code_ = HttpCode::OK;
+    keep_alive_ = keep_alive;
+}
+
+void HttpResponse::Clear()
+{
+    // swapped, a moved in string may keep its old buffer and a short
+    // one would be left pointing into the released arena
+    decltype(res_lst_)(resource_).swap(res_lst_);
+    decltype(temp_)(resource_).swap(temp_);
+    std::pmr::string(resource_).swap(response_);
+    std::pmr::string(resource_).swap(base_);
+    std::pmr::string(resource_).swap(full_path_);
+}
+
+void HttpResponse::InitComposed(HttpCode code)
+{
+    body_.reset();
+    file_.reset();
+    slurp_ = Slurp();
+    code_ = code;
+    keep_alive_ = false;
 }
 
 void HttpResponse::Compose()
 {
     response_.clear();
     res_lst_.clear();
-    slurp_ = Slurp(full_path_.native());
-
-    ComposeCode_();
-    Redirect_();
+    temp_.clear();
+    if (!body_) {
+        Read_(full_path_);
+        ComposeCode_();
+        Redirect_();
+    } else {
+        slurp_ = Slurp();
+        file_.reset();
+    }
     ComposeState_();
     ComposeHeader_();
     ComposeContent_();
@@ -56,13 +95,20 @@ void HttpResponse::Compose()
     for (auto& sv : res_lst_) response_.append(sv);
 }
 
+void HttpResponse::Read_(std::string_view path)
+{
+    file_ = file_cache ? file_cache->Get(path) : nullptr;
+    // the old file is dropped either way
+    slurp_ = file_ ? Slurp() : Slurp(path);
+}
+
 void HttpResponse::ComposeCode_()
 {
-    if (slurp_.error_message()) {
-        LOG_INFO(std::string(slurp_.state_message()) + ": " + slurp_.error_message().value());
-        if (slurp_.state() <= Slurp::State::OPEN) {
+    if (File_().error_message()) {
+        LOG_INFO("{}: {}", File_().state_message(), File_().error_message().value());
+        if (File_().state() <= Slurp::State::OPEN) {
             code_ = HttpCode::Not_Found;
-        } else if (slurp_.state() <= Slurp::State::READ) {
+        } else if (File_().state() <= Slurp::State::READ) {
             code_ = HttpCode::Forbidden;
         }
     } else if (code_ == HttpCode::Unknown) {
@@ -73,22 +119,20 @@ void HttpResponse::ComposeCode_()
 void HttpResponse::Redirect_()
 {
     if (auto find = code_path.find(code_); find != code_path.end()) {
-        auto path = std::filesystem::path(find->second).relative_path();
-        path = base_ / path;
-        slurp_ = Slurp(path.native());
-        if (slurp_.error_message()) {
-            LOG_ERROR(std::string(slurp_.state_message()) +
-                      ": " + slurp_.error_message().value() +
-                      " (" + std::string(find->second) + ")");
+        std::pmr::string path(resource_);
+        Join_(path, find->second);
+        Read_(path);
+        if (File_().error_message()) {
+            LOG_ERROR("{}: {} ({})", File_().state_message(),
+                      File_().error_message().value(), find->second);
         }
     }
 }
 
 void HttpResponse::ComposeState_()
 {
-    temp_.emplace_back(std::to_string(int(code_)));
     res_lst_.insert(res_lst_.end(),
-                    {"HTTP/1.1 ", std::string_view(temp_.back()),
+                    {"HTTP/1.1 ", Number_(int(code_)),
                      " ", code_, "\r\n"});
 }
 
@@ -99,19 +143,19 @@ void HttpResponse::ComposeHeader_()
         "keep-alive: max=6, timeout=120\r\n"};
     constexpr std::string_view close_header {
         "Connection: close\r\n"};
-    temp_.emplace_back(slurp_.error_message()
-                           ? std::to_string(ErrorHtml_().size())
-                           : std::to_string(slurp_.size()));
+    auto length = Number_(body_                   ? body_->size()
+                          : File_().error_message() ? ErrorHtml_().size()
+                                                   : File_().size());
 
     res_lst_.insert(res_lst_.end(),
                     {(keep_alive_ ? keep_alive_header : close_header),
-                     "Content-type: ", FileType_(), "\r\n",
-                     "Content-Length: ", temp_.back(), "\r\n\r\n"});
+                     "Content-type: ", body_ ? body_type_ : FileType_(), "\r\n",
+                     "Content-Length: ", length, "\r\n\r\n"});
 }
 
 void HttpResponse::ComposeContent_()
 {
-    if (slurp_.error_message()) {
+    if (File_().error_message()) {
         res_lst_.emplace_back(ErrorHtml_());
     }
 }
@@ -131,11 +175,29 @@ auto HttpResponse::FileType_() -> std::string_view
 {
     constexpr std::string_view default_type {
         "text/plain"};
-    auto ext = full_path_.extension();
-    if (ext.empty()) return default_type;
-    if (auto find = suffix_type.find(ext.native());
+    // the extension of the file name, none for dot files
+    std::string_view name = full_path_;
+    name.remove_prefix(name.rfind('/') + 1);
+    size_t dot = name.rfind('.');
+    if (dot == 0 || dot == std::string_view::npos) return default_type;
+    if (auto find = suffix_type.find(name.substr(dot));
         find != suffix_type.end()) {
         return find->second;
     }
     return default_type;
 }
+
+auto HttpResponse::Number_(size_t n) -> std::string_view
+{
+    char buf[24];
+    auto end = std::to_chars(buf, buf + sizeof(buf), n).ptr;
+    return temp_.emplace_back(buf, end);
+}
+
+void HttpResponse::Join_(std::pmr::string& out, std::string_view path)
+{
+    out.assign(base_);
+    if (!out.empty() && out.back() != '/') out.push_back('/');
+    path.remove_prefix(std::min(path.find_first_not_of('/'), path.size()));
+    out.append(path);
+}
@@ -1,4 +1,4 @@
 target("http")
     set_kind("static")
     add_files("*.cc")
-    add_deps("log", "buffer")
\ No newline at end of file
+    add_deps("log", "buffer", "metrics", "trace")
\ No newline at end of file
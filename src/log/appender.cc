@@ -1,33 +1,312 @@
 #include "log.hh"
 
+#include <cerrno>
+#include <cstdio>
+#include <deque>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+void LogAppender::Log(LogInfo const& info, LogEvent const& event)
+{
+    if (info.Level() < level_) return;
+    Append(info, event,
+           formatter_ ? formatter_->Format(info, event) : std::string_view());
+}
+
+void LogAppender::SetLevel(LogLevel level)
+{
+    level_ = level;
+    LogManager::Instance().UpdateRoutes();
+}
+
 StdoutLogAppender::StdoutLogAppender(
     LogLevel level, LogFormatter::ptr formatter) :
     LogAppender(level, formatter) { }
 
-void StdoutLogAppender::Log(LogInfo const& info, LogEvent::ptr event)
+void StdoutLogAppender::Append(
+    LogInfo const& info, LogEvent const& event, std::string_view text)
 {
-    if (info.Level() < level_) return;
-    std::cout << formatter_->Format(info, event);
+    std::cout.write(text.data(), text.size());
 }
 
+// ------------
+//  Compressor
+// ------------
+
+// gzips rotated segments one at a time on an idle priority thread
+class LogCompressor
+{
+public:
+    static auto Instance() -> LogCompressor&
+    {
+        // never destroyed, appenders may still hand over segments while
+        // static objects are torn down
+        static auto* compressor = new LogCompressor();
+        return *compressor;
+    }
+
+    void Add(std::string path)
+    {
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            paths_.emplace_back(std::move(path));
+        }
+        cond_.notify_one();
+    }
+
+private:
+    LogCompressor() :
+        thread_([this](std::stop_token token) { Run_(token); }) { }
+
+    void Run_(std::stop_token token)
+    {
+        ::setpriority(PRIO_PROCESS, ::syscall(SYS_gettid), 19);
+
+        std::unique_lock<std::mutex> locker(mtx_);
+        while (cond_.wait(locker, token, [this] { return !paths_.empty(); })) {
+            auto path = std::move(paths_.front());
+            paths_.pop_front();
+            locker.unlock();
+            Compress_(path);
+            locker.lock();
+        }
+    }
+
+    static void Compress_(std::string const& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        auto gz_path = path + ".gz";
+        gzFile gz = ::gzopen(gz_path.c_str(), "wb6");
+        bool ok = gz != nullptr;
+
+        char buf[64 << 10];
+        ssize_t len;
+        while (ok && (len = ::read(fd, buf, sizeof(buf))) > 0) {
+            ok = ::gzwrite(gz, buf, len) == len;
+        }
+        ok = ok && len == 0;
+        if (gz) ok = ::gzclose(gz) == Z_OK && ok;
+        ::close(fd);
+
+        if (ok) ::unlink(path.c_str());
+        else {
+            ::unlink(gz_path.c_str());
+            std::cerr << "Failed to compress " << path << std::endl;
+        }
+    }
+
+    std::mutex mtx_;
+    std::condition_variable_any cond_;
+    std::deque<std::string> paths_;
+    std::jthread thread_;
+};
+
+// -----------------
+//  FileLogAppender
+// -----------------
+
+struct FileLogAppender::Buffer {
+    // owner thread and background flusher, practically uncontended
+    void Lock()
+    {
+        while (busy_.test_and_set(std::memory_order_acquire)) busy_.wait(true);
+    }
+    void Unlock()
+    {
+        busy_.clear(std::memory_order_release);
+        busy_.notify_one();
+    }
+
+    std::atomic_flag busy_;
+    std::string data_;
+    int64_t flushed_ = LogClock::NowMs();
+};
+
 FileLogAppender::FileLogAppender(
     LogLevel level, LogFormatter::ptr formatter, std::string_view filename) :
+    FileLogAppender(level, formatter, filename, Options {}) { }
+
+FileLogAppender::FileLogAppender(
+    LogLevel level, LogFormatter::ptr formatter,
+    std::string_view filename, Options const& options) :
     LogAppender(level, formatter),
-    fstream_(std::string(filename))
+    name_(filename), options_(options), id_(0),
+    fd_(-1), written_(0), next_rotate_(0)
 {
-    if (!fstream_.is_open()) std::cerr << "Failed to open " << filename << std::endl;
+    static std::atomic<uint64_t> count;
+    id_ = ++count;
+
+    fd_ = Open_();
+    if (fd_ < 0) std::cerr << "Failed to open " << filename << std::endl;
+
+    background_ = std::jthread([this](std::stop_token token) { Background_(token); });
 }
 
-void FileLogAppender::Log(LogInfo const& info, LogEvent::ptr event)
+FileLogAppender::~FileLogAppender()
 {
-    if (info.Level() < level_) return;
-    // if (!fstream_.is_open()) fstream_.open(name_);
-    fstream_ << formatter_->Format(info, event);
+    background_.request_stop();
+    background_.join();
+
+    Flush();
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void FileLogAppender::Append(
+    LogInfo const& info, LogEvent const& event, std::string_view text)
+{
+    auto& buffer = LocalBuffer_();
+
+    buffer.Lock();
+    buffer.data_.append(text);
+    if (buffer.data_.size() >= options_.buffer_size ||
+        event.TimeMs() - buffer.flushed_ >= options_.flush_interval)
+        Write_(buffer);
+    buffer.Unlock();
+
+    if ((options_.max_size && written_ >= options_.max_size) ||
+        (options_.rotate_interval && event.TimeMs() >= next_rotate_))
+        Rotate();
+}
+
+void FileLogAppender::Flush()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    for (auto& buffer : buffers_) {
+        buffer->Lock();
+        Write_(*buffer);
+        buffer->Unlock();
+    }
 }
 
 auto FileLogAppender::Reopen() -> bool
 {
-    if (fstream_) fstream_.close();
-    fstream_.open(name_);
-    return bool(fstream_);
-}
\ No newline at end of file
+    int fd = Open_();
+    if (fd < 0) return false;
+    if (int old = Swap_(fd); old >= 0) ::close(old);
+    return true;
+}
+
+auto FileLogAppender::Rotate() -> bool
+{
+    if (rotating_.test_and_set(std::memory_order_acquire)) return false;
+
+    std::time_t now = LogClock::NowMs() / 1000;
+    std::tm tm;
+    ::localtime_r(&now, &tm);
+    char suffix[32];
+    std::strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &tm);
+
+    auto path = name_ + suffix;
+    for (int i = 1; ::access(path.c_str(), F_OK) == 0 ||
+                    ::access((path + ".gz").c_str(), F_OK) == 0;
+         ++i) {
+        path = name_ + suffix + '.' + std::to_string(i);
+    }
+
+    // until the swap writers append to the renamed segment, once it is
+    // closed it is complete and can be compressed
+    bool ok = ::rename(name_.c_str(), path.c_str()) == 0;
+    if (ok) {
+        int fd = Open_();
+        if (fd >= 0) {
+            if (int old = Swap_(fd); old >= 0) ::close(old);
+            if (options_.compress) LogCompressor::Instance().Add(path);
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) std::cerr << "Failed to rotate " << name_ << std::endl;
+
+    rotating_.clear(std::memory_order_release);
+    return ok;
+}
+
+auto FileLogAppender::LocalBuffer_() -> Buffer&
+{
+    thread_local std::vector<std::pair<uint64_t, Buffer*>> buffers;
+    for (auto [id, buffer] : buffers) {
+        if (id == id_) return *buffer;
+    }
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    auto& buffer = buffers_.emplace_back(new Buffer());
+    buffer->data_.reserve(options_.buffer_size);
+    buffers.emplace_back(id_, buffer.get());
+    return *buffer;
+}
+
+// buffer must be locked
+void FileLogAppender::Write_(Buffer& buffer)
+{
+    buffer.flushed_ = LogClock::NowMs();
+    if (buffer.data_.empty()) return;
+
+    std::string_view data = buffer.data_;
+    int fd = fd_;
+    while (!data.empty() && fd >= 0) {
+        ssize_t len = ::write(fd, data.data(), data.size());
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        data.remove_prefix(len);
+    }
+    written_ += buffer.data_.size() - data.size();
+    buffer.data_.clear();
+}
+
+auto FileLogAppender::Open_() -> int
+{
+    int fd = ::open(name_.c_str(),
+                    O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return fd;
+
+    struct ::stat st;
+    written_ = ::fstat(fd, &st) == 0 ? size_t(st.st_size) : 0;
+
+    if (options_.rotate_interval) {
+        auto interval = options_.rotate_interval * 1000;
+        next_rotate_ = (LogClock::NowMs() / interval + 1) * interval;
+    }
+    return fd;
+}
+
+auto FileLogAppender::Swap_(int fd) -> int
+{
+    // Write_ reads fd_ with its buffer locked; what it flushes here goes
+    // to the old file and does not count for the size of the new one
+    std::lock_guard<std::mutex> locker(mtx_);
+    size_t written = written_;
+    for (auto& buffer : buffers_) {
+        buffer->Lock();
+        Write_(*buffer);
+    }
+    int old = fd_.exchange(fd);
+    written_ = written;
+    for (auto& buffer : buffers_) buffer->Unlock();
+    return old;
+}
+
+void FileLogAppender::Background_(std::stop_token token)
+{
+    std::unique_lock<std::mutex> locker(mtx_);
+    while (!token.stop_requested()) {
+        cond_.wait_for(locker, token,
+                       std::chrono::milliseconds(std::max(options_.flush_interval, int64_t(10))),
+                       [] { return false; });
+
+        auto now = LogClock::NowMs();
+        for (auto& buffer : buffers_) {
+            buffer->Lock();
+            if (now - buffer->flushed_ >= options_.flush_interval) Write_(*buffer);
+            buffer->Unlock();
+        }
+    }
+}
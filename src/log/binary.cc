@@ -0,0 +1,257 @@
+#include "log.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr auto align8(size_t n) -> size_t { return (n + 7) & ~size_t(7); }
+
+template <typename T>
+auto bytes_of(T const& v) -> std::span<std::byte const>
+{
+    return {(std::byte const*)&v, sizeof(v)};
+}
+
+auto bytes_of(std::string_view s) -> std::span<std::byte const>
+{
+    return {(std::byte const*)s.data(), s.size()};
+}
+} // namespace
+
+struct BinaryLogAppender::Segment {
+    static constexpr size_t MAX_SITES = 1 << 16;
+    static constexpr size_t MAX_LOGGERS = 1 << 12;
+
+    // sets the bit of id, true if this call set it
+    static auto Claim(std::atomic<uint64_t>* bits, size_t max, uint32_t id) -> bool
+    {
+        if (id >= max) return true; // too many to track, define every time
+        uint64_t mask = uint64_t(1) << (id % 64);
+        return !(bits[id / 64].fetch_or(mask, std::memory_order_relaxed) & mask);
+    }
+
+    int fd = -1;
+    std::byte* data = nullptr;
+    size_t capacity = 0;
+
+    std::atomic<size_t> offset = 0;
+    std::atomic<int> writers = 0;
+
+    std::atomic<uint64_t> sites[MAX_SITES / 64] = {};
+    std::atomic<uint64_t> loggers[MAX_LOGGERS / 64] = {};
+};
+
+BinaryLogAppender::BinaryLogAppender(
+    LogLevel level, std::string_view filename, size_t segment_size) :
+    LogAppender(level, nullptr),
+    name_(filename),
+    segment_size_(std::max(segment_size, size_t(1) << 16)),
+    index_(0), current_(nullptr), truncated_(0)
+{
+    // continue after the segments of earlier runs
+    while (::access((name_ + '.' + std::to_string(index_)).c_str(), F_OK) == 0)
+        ++index_;
+
+    current_ = Open_();
+    if (!current_) std::cerr << "Failed to map " << filename << std::endl;
+}
+
+BinaryLogAppender::~BinaryLogAppender()
+{
+    for (auto& segment : segments_) Close_(segment.get());
+}
+
+void BinaryLogAppender::Append(
+    LogInfo const& info, LogEvent const& event, std::string_view text)
+{
+    // events made without a site carry their content as one argument
+    LogArg::buffer_t content;
+    auto args = event.Arguments();
+    if (!event.Site()) {
+        LogArg::Encode(content, event.Content());
+        args = content;
+    }
+
+    // arguments no segment can hold would roll segments without end;
+    // they are cut like in the flight recorder, the format stays
+    auto room = Room_(info, event);
+    if (room < 0) {
+        truncated_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (args.size() > size_t(room)) {
+        truncated_.fetch_add(1, std::memory_order_relaxed);
+        if (event.Site()) {
+            args = {};
+        } else {
+            content.clear();
+            LogArg::Encode(content, event.Content().substr(0, std::max<ptrdiff_t>(room - 5, 0)));
+            args = content;
+        }
+    }
+
+    LogEventRecord record {};
+    record.header.type = LogRecordHeader::EVENT;
+    record.header.len = int(info.Level());
+    record.header.id = event.Site() ? event.Site()->Id() : 0;
+    record.header.aux = info.LoggerId();
+    record.time = event.TimeMs();
+    record.elapsed = event.ElapsedMs();
+    record.fiber_id = event.FiberId();
+    record.thread_id = event.ThreadId();
+    record.args_size = args.size();
+
+    while (auto* segment = Acquire_()) {
+        bool ok = Define_(segment, info, event) &&
+                  Write_(segment, record.header,
+                         bytes_of(record).subspan(sizeof(record.header)),
+                         {args});
+        segment->writers.fetch_sub(1);
+        if (ok) return;
+        Roll_(segment);
+    }
+}
+
+auto BinaryLogAppender::Room_(LogInfo const& info, LogEvent const& event) const -> ptrdiff_t
+{
+    // an empty segment starts with its header and defines the logger
+    // and the site before the event
+    ptrdiff_t room = (segment_size_ & ~size_t(7)) - align8(sizeof(LogSegmentHeader)) -
+                     sizeof(LogEventRecord) - align8(sizeof(LogLoggerRecord) + info.Name().size());
+    if (auto const* site = event.Site()) {
+        room -= align8(sizeof(LogSiteRecord) + site->File().size() +
+                       site->FuncName().size() + site->Format().size());
+    }
+    return room;
+}
+
+auto BinaryLogAppender::Acquire_() -> Segment*
+{
+    // a segment is only unmapped while it has no writers and is no
+    // longer current, the second load catches a roll in between
+    while (true) {
+        auto* segment = current_.load();
+        if (!segment) return nullptr;
+        segment->writers.fetch_add(1);
+        if (current_.load() == segment) return segment;
+        segment->writers.fetch_sub(1);
+    }
+}
+
+auto BinaryLogAppender::Write_(
+    Segment* segment, LogRecordHeader header,
+    std::span<std::byte const> fixed,
+    std::initializer_list<std::span<std::byte const>> payload) -> bool
+{
+    size_t size = sizeof(header) + fixed.size();
+    for (auto& p : payload) size += p.size();
+    size = align8(size);
+
+    size_t offset = segment->offset.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size > segment->capacity) return false;
+
+    auto* p = segment->data + offset;
+    header.size = 0;
+    std::memcpy(p, &header, sizeof(header));
+    auto* q = p + sizeof(header);
+    std::memcpy(q, fixed.data(), fixed.size());
+    q += fixed.size();
+    for (auto& part : payload) {
+        std::memcpy(q, part.data(), part.size());
+        q += part.size();
+    }
+
+    std::atomic_ref<uint32_t>(*(uint32_t*)p).store(size, std::memory_order_release);
+    return true;
+}
+
+auto BinaryLogAppender::Define_(
+    Segment* segment, LogInfo const& info, LogEvent const& event) -> bool
+{
+    if (Segment::Claim(segment->loggers, Segment::MAX_LOGGERS, info.LoggerId())) {
+        LogLoggerRecord record {};
+        record.header.type = LogRecordHeader::LOGGER;
+        record.header.id = info.LoggerId();
+        record.name_size = info.Name().size();
+        if (!Write_(segment, record.header,
+                    bytes_of(record).subspan(sizeof(record.header)),
+                    {bytes_of(std::string_view(info.Name()))}))
+            return false;
+    }
+
+    auto const* site = event.Site();
+    if (site && Segment::Claim(segment->sites, Segment::MAX_SITES, site->Id())) {
+        LogSiteRecord record {};
+        record.header.type = LogRecordHeader::SITE;
+        record.header.id = site->Id();
+        record.header.aux = site->Line();
+        record.file_size = site->File().size();
+        record.func_size = site->FuncName().size();
+        record.format_size = site->Format().size();
+        if (!Write_(segment, record.header,
+                    bytes_of(record).subspan(sizeof(record.header)),
+                    {bytes_of(site->File()), bytes_of(site->FuncName()),
+                     bytes_of(site->Format())}))
+            return false;
+    }
+    return true;
+}
+
+void BinaryLogAppender::Roll_(Segment* full)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (current_.load() == full) {
+        auto* segment = Open_();
+        if (!segment) std::cerr << "Failed to map " << name_ << std::endl;
+        current_.store(segment);
+    }
+
+    for (auto& segment : segments_) {
+        if (segment.get() != current_.load() && segment->writers.load() == 0)
+            Close_(segment.get());
+    }
+}
+
+auto BinaryLogAppender::Open_() -> Segment*
+{
+    auto path = name_ + '.' + std::to_string(index_++);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return nullptr;
+
+    void* data = MAP_FAILED;
+    if (::ftruncate(fd, segment_size_) == 0) {
+        data = ::mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    LogSegmentHeader header {};
+    std::memcpy(header.magic, LogSegmentHeader::MAGIC, sizeof(header.magic));
+    header.header_size = align8(sizeof(header));
+    header.pid = ::getpid();
+    header.start_time = LogManager::Instance().StartTime();
+    header.created = LogClock::NowMs();
+    std::memcpy(data, &header, sizeof(header));
+
+    auto& segment = segments_.emplace_back(new Segment());
+    segment->fd = fd;
+    segment->data = (std::byte*)data;
+    segment->capacity = segment_size_;
+    segment->offset = header.header_size;
+    return segment.get();
+}
+
+void BinaryLogAppender::Close_(Segment* segment)
+{
+    if (!segment->data) return;
+    ::munmap(segment->data, segment->capacity);
+    int r = ::ftruncate(segment->fd, std::min(segment->offset.load(), segment->capacity));
+    (void)r;
+    ::close(segment->fd);
+    segment->data = nullptr;
+}
@@ -6,105 +6,91 @@
 
 struct MessageItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << event->Content(); }
+        LogEvent const& event)
+        override { LogField::Message(out, info, event); }
 };
 
 struct LevelItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << std::string(info.Level()); }
+        LogEvent const& event)
+        override { LogField::Level(out, info, event); }
 };
 
 struct NameItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << info.Name(); }
+        LogEvent const& event)
+        override { LogField::Name(out, info, event); }
 };
 
 struct FuncNameItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << event->FuncName(); }
+        LogEvent const& event)
+        override { LogField::FuncName(out, info, event); }
 };
 
 struct ElapseTimeItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override
-    {
-        auto time = event->ElapsedTime();
-        std::tm tm = *std::localtime(&time);
-        os << std::put_time(&tm, default_format);
-    }
-
-private:
-    static constexpr char const* default_format = "%Y:%m:%d %H:%M:%S";
+        LogEvent const& event)
+        override { LogField::ElapseTime(out, info, event); }
 };
 
 struct ThreadIdItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << event->ThreadId(); }
+        LogEvent const& event)
+        override { LogField::ThreadId(out, info, event); }
 };
 
 struct FiberIdItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << event->FiberId(); }
+        LogEvent const& event)
+        override { LogField::FiberId(out, info, event); }
 };
 
+template <bool Millis>
 struct TimeItem : LogFormatter::Item {
-    TimeItem(std::string const& format = default_format) :
+    TimeItem(std::string const& format = LogField::default_time_format) :
         format_(format)
     {
-        if (format.empty()) format_ = default_format;
+        if (format.empty()) format_ = LogField::default_time_format;
     }
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override
-    {
-        auto time = event->Time();
-        std::tm tm = *std::localtime(&time);
-        os << std::put_time(&tm, format_.c_str());
-    }
+        LogEvent const& event)
+        override { LogField::Time(out, event, format_.c_str(), Millis); }
 
 private:
-    static constexpr char const* default_format = "%Y:%m:%d %H:%M:%S";
-
     std::string format_;
 };
 
 struct FileItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << event->File(); }
+        LogEvent const& event)
+        override { LogField::File(out, info, event); }
 };
 
 struct LineItem : LogFormatter::Item {
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << event->Line(); }
+        LogEvent const& event)
+        override { LogField::Line(out, info, event); }
 };
 
 struct PlainTextItem : LogFormatter::Item {
@@ -112,10 +98,10 @@ struct PlainTextItem : LogFormatter::Item {
         text_(text) { }
 
     virtual void Format(
-        std::ostream& os,
+        std::string& out,
         LogInfo const& info,
-        LogEvent::ptr event)
-        override { os << text_; }
+        LogEvent const& event)
+        override { out.append(text_); }
 
 private:
     std::string text_;
@@ -129,17 +115,29 @@ LogFormatter::LogFormatter(std::string_view pattern) :
     pattern_(pattern),
     items_()
 {
-    ItemGen(ParsePattern());
+    auto items = ParsePattern();
+    uses_name_ = std::ranges::any_of(items, [](auto const& item) {
+        return item.second && item.first == "c";
+    });
+    ItemGen(std::move(items));
 }
 
-auto LogFormatter::Format(LogInfo const& info, LogEvent::ptr event)
-    -> std::string
+void LogFormatter::Format(
+    std::string& out, LogInfo const& info, LogEvent const& event) const
 {
-    std::stringstream ss;
+    if (compiled_) return compiled_(out, info, event);
     for (auto& item : items_) {
-        item->Format(ss, info, event);
+        item->Format(out, info, event);
     }
-    return ss.str();
+}
+
+auto LogFormatter::Format(LogInfo const& info, LogEvent const& event) const
+    -> std::string_view
+{
+    thread_local std::string buffer;
+    buffer.clear();
+    Format(buffer, info, event);
+    return buffer;
 }
 
 // %c log name
@@ -148,6 +146,7 @@ auto LogFormatter::Format(LogInfo const& info, LogEvent::ptr event)
 // %r elapsed time
 // %t thread id
 // %d time
+// %D time with milliseconds
 // %n line feed
 // %f file name
 // %l file line number
@@ -227,7 +226,8 @@ void LogFormatter::ItemGen(
             HELPER(f, FileItem),
             HELPER(l, LineItem),
 
-            HELPER_FMT(d, TimeItem),
+            HELPER_FMT(d, TimeItem<false>),
+            HELPER_FMT(D, TimeItem<true>),
 
             HELPER_PLAIN(%, %),
             HELPER_PLAIN(n, \n),
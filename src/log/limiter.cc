@@ -0,0 +1,122 @@
+#include "log.hh"
+
+auto LogLimiter::Instance() -> LogLimiter&
+{
+    // never destroyed, call sites may log while static objects are
+    // torn down
+    static auto* limiter = new LogLimiter();
+    return *limiter;
+}
+
+void LogLimiter::Configure(Options const& options)
+{
+    int64_t interval = options.rate > 0 ? int64_t(1e6 / options.rate) : 0;
+    interval_.store(interval);
+    tolerance_.store(interval * (std::max(options.burst, uint32_t(1)) - 1));
+    collapse_.store(options.collapse);
+    flush_interval_.store(std::max(options.flush_interval, int64_t(10)));
+
+    bool enabled = interval || options.collapse;
+    level_.store(enabled ? int(options.level) : LogLevel::FATAL + 1);
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (enabled && !background_.joinable()) {
+        background_ = std::jthread([this](std::stop_token token) { Background_(token); });
+    }
+}
+
+void LogLimiter::Flush()
+{
+    std::vector<LogSite const*> sites;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        sites = sites_;
+    }
+    auto now = LogClock::NowMs();
+    for (auto const* site : sites) Report_(*site, now);
+}
+
+auto LogLimiter::Admit_(LogLevel level, LogSite const& site,
+                        LogEvent const& event, LogRoute const* route) -> bool
+{
+    auto& limit = site.Limits();
+
+    if (collapse_.load(std::memory_order_relaxed)) {
+        auto args = event.Arguments();
+        uint64_t hash = std::hash<std::string_view>()(
+                            {(char const*)args.data(), args.size()}) |
+                        1;
+        if (limit.last.exchange(hash, std::memory_order_relaxed) == hash) {
+            limit.repeated.fetch_add(1, std::memory_order_relaxed);
+            List_(site, level, route);
+            return false;
+        }
+        // a different message ends the run of repeats
+        if (limit.repeated.load(std::memory_order_relaxed)) Report_(site, event.TimeMs());
+    }
+
+    if (auto interval = interval_.load(std::memory_order_relaxed)) {
+        auto const tolerance = tolerance_.load(std::memory_order_relaxed);
+        auto const now = event.TimeMs() * 1000;
+        auto tat = limit.tat.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            if (tat - now > tolerance) {
+                limit.suppressed.fetch_add(1, std::memory_order_relaxed);
+                List_(site, level, route);
+                return false;
+            }
+            next = std::max(tat, now) + interval;
+        } while (!limit.tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+    }
+    return true;
+}
+
+void LogLimiter::List_(LogSite const& site, LogLevel level, LogRoute const* route)
+{
+    auto& limit = site.Limits();
+    if (limit.listed.test(std::memory_order_relaxed)) return;
+
+    limit.level.store(int(level), std::memory_order_relaxed);
+    limit.route.store(route, std::memory_order_relaxed);
+    if (limit.listed.test_and_set()) return;
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    sites_.push_back(&site);
+}
+
+void LogLimiter::Report_(LogSite const& site, int64_t now)
+{
+    auto& limit = site.Limits();
+    auto const level = static_cast<decltype(LogLevel::UNKNOWN)>(
+        limit.level.load(std::memory_order_relaxed));
+    auto const* route = limit.route.load(std::memory_order_relaxed);
+
+    auto report = [&](std::string const& content) {
+        LogEvent event(site.File(), site.FuncName(), site.Line(),
+                       LogEvent::CurrentThreadId(), Fiber::GetId(),
+                       now - LogManager::Instance().StartTime(), now, content);
+        if (route) route->Log(level, event);
+        else LogManager::Log(level, event);
+    };
+
+    if (auto n = limit.repeated.exchange(0, std::memory_order_relaxed)) {
+        report(std::format("last message repeated {} times", n));
+    }
+    if (auto n = limit.suppressed.exchange(0, std::memory_order_relaxed)) {
+        report(std::format("{} messages suppressed by rate limit", n));
+    }
+}
+
+void LogLimiter::Background_(std::stop_token token)
+{
+    while (!token.stop_requested()) {
+        {
+            std::unique_lock<std::mutex> locker(mtx_);
+            cond_.wait_for(locker, token,
+                           std::chrono::milliseconds(flush_interval_.load()),
+                           [] { return false; });
+        }
+        Flush();
+    }
+}
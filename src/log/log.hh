@@ -7,22 +7,33 @@
 #include <ctime>
 #include <stdexcept>
 
+#include <format>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <ranges>
+#include <source_location>
+#include <span>
 #include <sstream>
 #include <type_traits>
 
+#include <array>
 #include <list>
 #include <map>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include <pthread.h>
@@ -32,10 +43,12 @@
 #include "magic_enum.hh"
 
 #include "fiber/fiber.hh"
+#include "record.hh"
 
 class Logger;
 class LogAppender;
 class LogManager;
+class LogRoute;
 
 class LogLevel
 {
@@ -71,50 +84,187 @@ private:
     Level level_;
 };
 
+// Wall clock in milliseconds, read from CLOCK_REALTIME_COARSE which
+// every thread shares through the vDSO without a syscall. Resolution
+// is one kernel tick (1-4 ms), plenty for log timestamps.
+struct LogClock {
+    static auto NowMs() -> int64_t
+    {
+        ::timespec ts;
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1'000'000;
+    }
+};
+
+// A logging call site, one static instance per LOG macro expansion.
+// Sites are numbered from 1 in the order they are first reached.
+class LogSite
+{
+public:
+    LogSite(std::source_location const& location, std::string_view format);
+
+    LogSite(LogSite const&) = delete;
+
+    auto File() const { return file_; }
+    auto FuncName() const { return func_name_; }
+    auto Line() const { return line_; }
+    auto Format() const { return format_; }
+    auto Id() const { return id_; }
+
+    // rate limit and duplicate state, kept by LogLimiter
+    struct Limit {
+        std::atomic<int64_t> tat = 0; // us, GCRA theoretical arrival
+        std::atomic<uint64_t> last = 0;
+        std::atomic<uint32_t> repeated = 0;
+        std::atomic<uint32_t> suppressed = 0;
+        std::atomic<int> level = 0;
+        std::atomic<LogRoute const*> route = nullptr;
+        std::atomic_flag listed;
+    };
+    auto& Limits() const { return limit_; }
+
+private:
+    std::string_view file_;
+    std::string_view func_name_;
+    int line_;
+    std::string_view format_;
+    uint32_t id_;
+    mutable Limit limit_;
+};
+
+// A log record. Source locations point at static storage, the content
+// and the typed arguments live in arenas of the thread that made the
+// event, so an event is only valid until that thread makes the next
+// one. Events made at a LogSite keep their arguments binary and only
+// format the content when it is first asked for.
 class LogEvent
 {
 public:
     typedef LogEvent self;
-    typedef std::shared_ptr<self> ptr;
 
-    template <typename U>
-    LogEvent(std::string_view file,
-             std::string_view func_name,
-             int line,
-             std::thread::id thread_id,
-             Fiber::id_t fiber_id,
-             time_t elapsed_time,
-             time_t time,
-             U&& content) :
+    constexpr LogEvent(std::string_view file,
+                       std::string_view func_name,
+                       int line,
+                       pid_t thread_id,
+                       Fiber::id_t fiber_id,
+                       int64_t elapsed_ms,
+                       int64_t time_ms,
+                       std::string_view content) :
         file_(file),
         func_name_(func_name),
         line_(line),
         thread_id_(thread_id),
         fiber_id_(fiber_id),
-        elapsed_time_(elapsed_time),
-        time_(time),
-        content_(std::forward<U>(content)) { }
-
-    auto const& File() const { return file_; }
-    auto const& FuncName() const { return func_name_; }
+        elapsed_ms_(elapsed_ms),
+        time_ms_(time_ms),
+        site_(nullptr),
+        args_(),
+        render_(nullptr),
+        content_(content) { }
+
+    // formats the content right away
+    template <typename... Args>
+    static auto Make(std::source_location const& location,
+                     std::format_string<Args...> fmt, Args&&... args) -> self;
+
+    // encodes the arguments, the content is formatted on demand
+    template <typename... Args>
+    static auto Make(LogSite const& site,
+                     std::format_string<Args...> fmt, Args&&... args) -> self;
+
+    auto File() const { return file_; }
+    auto FuncName() const { return func_name_; }
     auto Line() const { return line_; }
     auto ThreadId() const { return thread_id_; }
     auto FiberId() const { return fiber_id_; }
-    auto ElapsedTime() const { return elapsed_time_; }
-    auto Time() const { return time_; }
-    auto const& Content() const { return content_; }
+    auto ElapsedTime() const -> time_t { return elapsed_ms_ / 1000; }
+    auto Time() const -> time_t { return time_ms_ / 1000; }
+    auto ElapsedMs() const { return elapsed_ms_; }
+    auto TimeMs() const { return time_ms_; }
+    auto Site() const { return site_; }
+    auto Arguments() const { return args_; }
+
+    auto Content() const -> std::string_view
+    {
+        if (render_) {
+            content_ = render_(site_->Format(), args_);
+            render_ = nullptr;
+        }
+        return content_;
+    }
+
+    static auto CurrentThreadId() -> pid_t
+    {
+        thread_local pid_t const tid = ::syscall(SYS_gettid);
+        return tid;
+    }
 
 private:
-    std::string file_;
-    std::string func_name_;
+    typedef auto (*render_t)(std::string_view, std::span<std::byte const>)
+        -> std::string_view;
+
+    template <typename... Args>
+    static auto Render_(std::string_view fmt, std::span<std::byte const> args)
+        -> std::string_view
+    {
+        [[maybe_unused]] auto p = args.data();
+        std::tuple<LogArg::type_t<Args>...> values {
+            LogArg::Decode<LogArg::type_t<Args>>(p)...};
+
+        auto& arena = Arena_();
+        arena.clear();
+        try {
+            std::apply([&](auto&... v) {
+                std::vformat_to(std::back_inserter(arena), fmt,
+                                std::make_format_args(v...));
+            },
+                       values);
+        } catch (std::format_error const&) {
+            // a spec of a type stored as its "{}" string, each field
+            // falls back on its own
+            arena.clear();
+            LogArg::Render(arena, fmt, args);
+        }
+        return arena;
+    }
+
+    static auto ArgsArena_() -> LogArg::buffer_t&
+    {
+        thread_local LogArg::buffer_t arena = [] {
+            LogArg::buffer_t v;
+            v.reserve(ARENA_SIZE);
+            return v;
+        }();
+        return arena;
+    }
+
+    static auto Arena_() -> std::string&
+    {
+        thread_local std::string arena = [] {
+            std::string s;
+            s.reserve(ARENA_SIZE);
+            return s;
+        }();
+        return arena;
+    }
+
+    static constexpr size_t ARENA_SIZE = 4096;
+
+    std::string_view file_;
+    std::string_view func_name_;
     int line_;
-    std::thread::id thread_id_;
+    pid_t thread_id_;
     Fiber::id_t fiber_id_;
-    time_t elapsed_time_;
-    time_t time_;
-    std::string content_;
+    int64_t elapsed_ms_;
+    int64_t time_ms_;
+    LogSite const* site_;
+    std::span<std::byte const> args_;
+    mutable render_t render_;
+    mutable std::string_view content_;
 };
 
+static_assert(std::is_trivially_copyable_v<LogEvent>);
+
 class LogInfo
 {
 public:
@@ -122,12 +272,16 @@ public:
 
     auto const& Name() const { return logger_name_; }
     auto const& Level() const { return level_; }
+    auto LoggerId() const { return logger_id_; }
 
 private:
     std::string const& logger_name_;
+    uint32_t logger_id_;
     LogLevel level_;
 };
 
+#include "pattern.hh"
+
 class LogFormatter
 {
 public:
@@ -136,7 +290,7 @@ public:
         typedef std::shared_ptr<self> ptr;
         virtual ~Item() = default;
         virtual void Format(
-            std::ostream& os, LogInfo const& info, LogEvent::ptr event) = 0;
+            std::string& out, LogInfo const& info, LogEvent const& event) = 0;
 
     protected:
         friend class LogFormatter;
@@ -149,11 +303,37 @@ public:
 
     LogFormatter(std::string_view pattern = default_pattern);
 
+    // a formatter for a pattern known at build time, parsed at compile
+    // time into typed segments without per-item virtual calls:
+    //     LogFormatter::Compile<"[%d] [%p] %m%n">()
+    template <LogPattern P>
+    static auto Compile() -> ptr
+    {
+        constexpr bool uses_name = std::ranges::any_of(
+            StaticLogFormatter<P>::Segments(),
+            [](LogSegment s) { return s.kind == LogSegment::NAME; });
+        return ptr(new LogFormatter(P.View(), &StaticLogFormatter<P>::Format, uses_name));
+    }
+
     auto const& Pattern() const { return pattern_; }
 
-    auto Format(LogInfo const& info, LogEvent::ptr event) -> std::string;
+    // the output depends on the logger name (%c)
+    auto UsesName() const { return uses_name_; }
+
+    // appends the formatted event to out
+    void Format(std::string& out,
+                LogInfo const& info, LogEvent const& event) const;
+
+    // formats into a thread-local buffer that the next call reuses
+    auto Format(LogInfo const& info, LogEvent const& event) const
+        -> std::string_view;
 
 private:
+    typedef void (*compiled_t)(std::string&, LogInfo const&, LogEvent const&);
+
+    LogFormatter(std::string_view pattern, compiled_t compiled, bool uses_name) :
+        pattern_(pattern), items_(), compiled_(compiled), uses_name_(uses_name) { }
+
     auto ParsePattern()
         -> std::vector<std::pair<std::string, std::optional<std::string>>>;
     void ItemGen(
@@ -164,6 +344,8 @@ private:
 
     std::string pattern_;
     std::vector<Item::ptr> items_;
+    compiled_t compiled_ = nullptr;
+    bool uses_name_ = false;
 };
 
 class LogAppender
@@ -177,11 +359,17 @@ public:
 
     virtual ~LogAppender() = default;
 
-    virtual void Log(LogInfo const& info, LogEvent::ptr event) = 0;
+    // formats the event with its own formatter, Logger calls Append
+    // directly to share one formatted output between appenders
+    void Log(LogInfo const& info, LogEvent const& event);
+
+    // text is the event formatted by Formatter()
+    virtual void Append(LogInfo const& info, LogEvent const& event,
+                        std::string_view text) = 0;
 
     auto const& Level() const { return level_; }
-    auto Formatter() { return formatter_; }
-    void SetLevel(LogLevel level) { level_ = level; }
+    auto const& Formatter() const { return formatter_; }
+    void SetLevel(LogLevel level);
     void SetFormatter(LogFormatter::ptr formatter) { formatter_ = formatter; }
 
 protected:
@@ -199,32 +387,89 @@ public:
         Logger(LogLevel::DEBUG) { }
     Logger(LogLevel level, std::string_view name = default_name);
 
-    void Log(LogLevel level, LogEvent::ptr event);
+    void Log(LogLevel level, LogEvent const& event);
 
-    void Debug(LogEvent::ptr event);
-    void Info(LogEvent::ptr event);
-    void Warn(LogEvent::ptr event);
-    void Error(LogEvent::ptr event);
-    void Fatal(LogEvent::ptr event);
+    void Debug(LogEvent const& event);
+    void Info(LogEvent const& event);
+    void Warn(LogEvent const& event);
+    void Error(LogEvent const& event);
+    void Fatal(LogEvent const& event);
 
     void AddAppender(LogAppender::ptr appender);
     void DelAppender(LogAppender::ptr appender);
 
     auto const& Level() const { return level_; }
-    void SetLevel(LogLevel level) { level_ = level; }
+    void SetLevel(LogLevel level);
+
+    // lowest level that reaches at least one appender
+    auto EffectiveLevel() const -> int;
 
     auto const& Name() const { return name_; }
     auto const& Appenders() const { return appenders_; }
 
-private:
+    // process-wide, numbered from 1
+    auto Id() const { return id_; }
+
+    // also the root of every logger hierarchy
     static constexpr char const* default_name = "root";
 
+private:
+
+    uint32_t id_;
     LogLevel level_;
     std::string name_;
     std::string format_;
     std::list<LogAppender::ptr> appenders_;
 };
 
+// The appenders an event logged under a name reaches, flattened once
+// from the logger of that name and its ancestors ("http.access",
+// "http", then "root"), or from every logger for the LOG_* macros.
+// Each appender appears once and each formatter runs once per event.
+// LogManager rebuilds routes when loggers change; call sites keep a
+// reference, as routes live as long as the manager.
+class LogRoute
+{
+public:
+    typedef LogRoute self;
+
+    LogRoute(std::string_view name);
+
+    LogRoute(self const&) = delete;
+
+    auto Name() const -> std::string_view { return logger_.Name(); }
+
+    auto Enabled(LogLevel level) const -> bool
+    {
+        return int(level) >= level_.load(std::memory_order_relaxed);
+    }
+
+    void Log(LogLevel level, LogEvent const& event) const;
+
+private:
+    friend class LogManager;
+
+    struct Target {
+        LogAppender::ptr appender;
+        // the name the event is formatted with
+        Logger const* logger;
+        // of the appender and the logger that holds it
+        int level;
+    };
+    typedef std::vector<Target> targets_t;
+
+    // under the manager's lock
+    void Update(targets_t&& targets);
+
+    // names the events of a named route, never holds appenders
+    Logger logger_;
+
+    std::atomic<int> level_;
+    std::atomic<targets_t const*> targets_;
+    // replaced lists, a concurrent Log may still walk one
+    std::vector<std::unique_ptr<targets_t>> retired_;
+};
+
 #include "instance/instance.hh"
 
 class LogManager
@@ -250,8 +495,19 @@ public:
     auto const& Formatters() const { return formatters_; }
     auto const& Appenders() const { return appenders_; }
     auto const& Loggers() const { return loggers_; }
+    // milliseconds, see LogClock
     auto const& StartTime() const { return start_time_; }
 
+    // the route of a logger name, created on first use
+    auto Route(std::string_view name) -> LogRoute&;
+
+    // rebuild the routes and their level gates after the loggers or
+    // their appenders change
+    void UpdateRoutes();
+
+    // an appender every route reaches, see LogRecorder
+    void SetRecorder(LogAppender::ptr recorder);
+
     LogManager() = default;
     LogManager(self const& other) = delete;
     LogManager(self&&) = delete;
@@ -263,7 +519,16 @@ private:
     std::vector<std::pair<std::string, LogAppender::ptr>> appenders_;
     std::map<std::string_view, Logger::ptr> loggers_;
 
-    time_t start_time_ = ::time(nullptr);
+    int64_t start_time_ = LogClock::NowMs();
+
+    auto Targets_(std::string_view name, Logger const* logger) const
+        -> LogRoute::targets_t;
+
+    std::mutex mtx_;
+    // every logger, for LOG_*
+    LogRoute all_ {Logger::default_name};
+    LogAppender::ptr recorder_;
+    std::map<std::string, std::unique_ptr<LogRoute>, std::less<>> routes_;
 
 public:
     static auto& Instance()
@@ -272,20 +537,115 @@ public:
         return manager;
     }
 
-    static void Log(LogLevel level, LogEvent::ptr event)
+    static auto Enabled(LogLevel level) -> bool
     {
-        for (auto const& logger : Instance().Loggers() | std::views::values) {
-            // std::cout << logger->Name() << std::endl;
-            logger->Log(level, event);
-        }
+        return Instance().all_.Enabled(level);
+    }
+
+    static void Log(LogLevel level, LogEvent const& event)
+    {
+        Instance().all_.Log(level, event);
+    }
+    static void Debug(LogEvent const& event) { Log(LogLevel::DEBUG, event); }
+    static void Info(LogEvent const& event) { Log(LogLevel::INFO, event); }
+    static void Warn(LogEvent const& event) { Log(LogLevel::WARN, event); }
+    static void Error(LogEvent const& event) { Log(LogLevel::ERROR, event); }
+    static void Fatal(LogEvent const& event) { Log(LogLevel::FATAL, event); }
+};
+
+// Keeps error storms from making logging the bottleneck. Per call
+// site, at or above a level:
+//  - a token bucket (GCRA, one CAS) drops events beyond rate/s with
+//    bursts of burst events;
+//  - an event with the same arguments as the previous one of its site
+//    is dropped and counted.
+// A background thread reports the counts every flush_interval ms as
+// "suppressed N" and "last message repeated N times" lines at the
+// sites, so a storm costs a constant amount of output.
+class LogLimiter
+{
+public:
+    struct Options {
+        LogLevel level = LogLevel::WARN;
+        double rate = 0; // per second, 0 for no rate limit
+        uint32_t burst = 1;
+        bool collapse = false;
+        int64_t flush_interval = 5000; // ms
+    };
+
+    static auto Instance() -> LogLimiter&;
+
+    void Configure(Options const& options);
+
+    // route is null for the LOG_* macros
+    static auto Admit(LogLevel level, LogSite const& site,
+                      LogEvent const& event, LogRoute const* route) -> bool
+    {
+        auto& limiter = Instance();
+        if (int(level) < limiter.level_.load(std::memory_order_relaxed)) return true;
+        return limiter.Admit_(level, site, event, route);
     }
-    static void Debug(LogEvent::ptr event) { Log(LogLevel::DEBUG, event); }
-    static void Info(LogEvent::ptr event) { Log(LogLevel::INFO, event); }
-    static void Warn(LogEvent::ptr event) { Log(LogLevel::WARN, event); }
-    static void Error(LogEvent::ptr event) { Log(LogLevel::ERROR, event); }
-    static void Fatal(LogEvent::ptr event) { Log(LogLevel::FATAL, event); }
+
+    // report the pending counts now
+    void Flush();
+
+private:
+    LogLimiter() = default;
+
+    auto Admit_(LogLevel level, LogSite const& site,
+                LogEvent const& event, LogRoute const* route) -> bool;
+
+    void List_(LogSite const& site, LogLevel level, LogRoute const* route);
+    static void Report_(LogSite const& site, int64_t now);
+
+    void Background_(std::stop_token token);
+
+    // disabled until configured
+    std::atomic<int> level_ = LogLevel::FATAL + 1;
+    std::atomic<int64_t> interval_ = 0; // us per token
+    std::atomic<int64_t> tolerance_ = 0; // us, the burst
+    std::atomic<bool> collapse_ = false;
+    std::atomic<int64_t> flush_interval_ = 5000;
+
+    std::mutex mtx_;
+    std::condition_variable_any cond_;
+    // sites that dropped events at least once
+    std::vector<LogSite const*> sites_;
+    std::jthread background_;
 };
 
+template <typename... Args>
+auto LogEvent::Make(std::source_location const& location,
+                    std::format_string<Args...> fmt, Args&&... args) -> self
+{
+    auto& arena = Arena_();
+    arena.clear();
+    std::format_to(std::back_inserter(arena), fmt, std::forward<Args>(args)...);
+
+    auto const now = LogClock::NowMs();
+    return self(location.file_name(), location.function_name(),
+                location.line(), CurrentThreadId(), Fiber::GetId(),
+                now - LogManager::Instance().StartTime(), now, arena);
+}
+
+template <typename... Args>
+auto LogEvent::Make(LogSite const& site,
+                    std::format_string<Args...> fmt, Args&&... args) -> self
+{
+    auto& arena = ArgsArena_();
+    arena.clear();
+    (LogArg::Encode(arena, args), ...);
+
+    auto const now = LogClock::NowMs();
+    self event(site.File(), site.FuncName(), site.Line(),
+               CurrentThreadId(), Fiber::GetId(),
+               now - LogManager::Instance().StartTime(), now, {});
+    event.site_ = &site;
+    event.args_ = arena;
+    event.render_ = &Render_<Args...>;
+    return event;
+}
+
 // ----------------------
 //  LogAppender Subclass
 // ----------------------
@@ -298,49 +658,241 @@ public:
 
     StdoutLogAppender(LogLevel level, LogFormatter::ptr formatter);
 
-    virtual void Log(LogInfo const& info, LogEvent::ptr event)
-        override;
+    virtual void Append(LogInfo const& info, LogEvent const& event,
+                        std::string_view text) override;
 
 private:
 };
 
+// Buffers records per producer thread and writes them with one
+// write(2) to an O_APPEND fd, so concurrent threads never interleave
+// inside a record and never contend on a shared lock. Buffers are
+// flushed when full, and every flush_interval by a background thread.
+// The file rotates by size or time through an atomic rename, rotated
+// segments can be gzipped by a low priority thread.
 class FileLogAppender : public LogAppender
 {
 public:
     typedef FileLogAppender self;
     typedef std::shared_ptr<self> ptr;
 
+    struct Options {
+        size_t buffer_size = 64 << 10;   // per producer thread
+        int64_t flush_interval = 1000;   // ms
+        size_t max_size = 0;             // bytes, 0 never rotates by size
+        int64_t rotate_interval = 0;     // seconds, 0 never rotates by time
+        bool compress = false;           // gzip rotated segments
+    };
+
     FileLogAppender(LogLevel level, LogFormatter::ptr formatter,
                     std::string_view filename);
+    FileLogAppender(LogLevel level, LogFormatter::ptr formatter,
+                    std::string_view filename, Options const& options);
+
+    ~FileLogAppender();
 
     auto const& FileName() const { return name_; }
+    auto const& GetOptions() const { return options_; }
+
+    virtual void Append(LogInfo const& info, LogEvent const& event,
+                        std::string_view text) override;
 
-    virtual void Log(LogInfo const& info, LogEvent::ptr event)
-        override;
+    // writes out the buffers of every producer thread
+    void Flush();
 
+    // reopens the file, e.g. after it was moved by an external tool
     auto Reopen() -> bool;
 
+    // renames the file to <name>.<time> and starts a new one
+    auto Rotate() -> bool;
+
+private:
+    struct Buffer;
+
+    auto LocalBuffer_() -> Buffer&;
+    void Write_(Buffer& buffer);
+    auto Open_() -> int;
+    // flushes the buffers to the old fd and swaps in fd, with every
+    // buffer locked so no writer holds the old one; returns it
+    auto Swap_(int fd) -> int;
+    void Background_(std::stop_token token);
+
+    std::string name_;
+    Options options_;
+    uint64_t id_;
+
+    std::atomic<int> fd_;
+    std::atomic<size_t> written_;
+    std::atomic<int64_t> next_rotate_;
+    std::atomic_flag rotating_;
+
+    // only touched when a thread first logs here and by the background
+    // thread, never on the write path
+    std::mutex mtx_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+
+    std::condition_variable_any cond_;
+    std::jthread background_;
+};
+
+// Writes events as compact binary records (see record.hh) into memory
+// mapped, append-only segment files <name>.<n>. A producer reserves
+// its record with one fetch_add and copies the typed arguments, nothing
+// is formatted; the logcat tool turns segments back into text with any
+// pattern. Each segment defines the sites and loggers it refers to.
+class BinaryLogAppender : public LogAppender
+{
+public:
+    typedef BinaryLogAppender self;
+    typedef std::shared_ptr<self> ptr;
+
+    BinaryLogAppender(LogLevel level, std::string_view filename,
+                      size_t segment_size = 64 << 20);
+
+    ~BinaryLogAppender();
+
+    auto const& FileName() const { return name_; }
+
+    // events too large for a segment, written without their arguments
+    // (cut when already formatted) or dropped
+    auto Truncated() const -> uint64_t { return truncated_.load(std::memory_order_relaxed); }
+
+    // the formatted text is ignored, appenders of this kind have no
+    // formatter so Logger never formats for them
+    virtual void Append(LogInfo const& info, LogEvent const& event,
+                        std::string_view text) override;
+
 private:
+    struct Segment;
+
+    auto Acquire_() -> Segment*;
+    auto Write_(Segment* segment, LogRecordHeader header,
+                std::span<std::byte const> fixed,
+                std::initializer_list<std::span<std::byte const>> payload)
+        -> bool;
+    auto Define_(Segment* segment, LogInfo const& info, LogEvent const& event)
+        -> bool;
+    // bytes of arguments an empty segment has room for, < 0 for none
+    auto Room_(LogInfo const& info, LogEvent const& event) const -> ptrdiff_t;
+    void Roll_(Segment* full);
+    auto Open_() -> Segment*;
+    void Close_(Segment* segment);
+
     std::string name_;
-    std::ofstream fstream_;
+    size_t segment_size_;
+    uint32_t index_;
+
+    std::atomic<Segment*> current_;
+    std::atomic<uint64_t> truncated_;
+
+    // taken when a segment is full, never on the write path
+    std::mutex mtx_;
+    std::vector<std::unique_ptr<Segment>> segments_;
 };
 
-#include <source_location>
+// Flight recorder: keeps the last size events of every thread in
+// memory, at its own level regardless of the other appenders, and
+// dumps them when the process crashes (SIGSEGV, SIGABRT, ...) or on
+// SIGUSR2 to <path>.<pid>.<n>, in the format of BinaryLogAppender so
+// logcat decodes it. Recording copies the binary arguments into a
+// per-thread ring, a single writer with a sequence number per slot;
+// the dump only uses write() and static storage.
+class LogRecorder : public LogAppender
+{
+public:
+    typedef LogRecorder self;
+    typedef std::shared_ptr<self> ptr;
+
+    struct Options {
+        LogLevel level = LogLevel::DEBUG;
+        size_t size = 4096; // events per thread, rounded up to a power of 2
+        std::string path = "flight.bin";
+        bool signals = true;
+    };
+
+    // one per process, the first call sizes the rings, later ones
+    // change the level and path
+    static auto Install(Options const& options) -> ptr;
+
+    ~LogRecorder();
+
+    virtual void Append(LogInfo const& info, LogEvent const& event,
+                        std::string_view text) override;
+
+    // async-signal-safe, false if a dump is already running
+    auto Dump() -> bool;
+
+private:
+    struct Slot;
+    struct Ring;
+    class Writer;
+
+    LogRecorder(Options const& options);
+
+    auto LocalRing_() -> Ring*;
+
+    static void OnSignal_(int sig);
+
+    static constexpr size_t MAX_THREADS = 256;
+
+    size_t size_;
+    // "<path>.<pid>.", the dump number is appended
+    char path_[256];
+    std::atomic<uint32_t> dumps_;
+    std::atomic_flag dumping_;
+
+    std::atomic<size_t> ring_count_;
+    std::atomic<Ring*> rings_[MAX_THREADS];
+};
 
-#define LOG(level, content)                                                              \
-    LogManager::Instance().Log(level,                                                    \
-                               LogEvent::ptr {new LogEvent(                              \
-                                   std::source_location::current().file_name(),          \
-                                   std::source_location::current().function_name(),      \
-                                   std::source_location::current().line(),               \
-                                   std::this_thread::get_id(), Fiber::GetId(),           \
-                                   ::time(nullptr) - LogManager::Instance().StartTime(), \
-                                   ::time(nullptr), content)})
-
-#define LOG_DEBUG(content) LOG(LogLevel::DEBUG, content)
-#define LOG_INFO(content)  LOG(LogLevel::INFO, content)
-#define LOG_WARN(content)  LOG(LogLevel::WARN, content)
-#define LOG_ERROR(content) LOG(LogLevel::ERROR, content)
-#define LOG_FATAL(content) LOG(LogLevel::FATAL, content)
+// Call sites below LOG_ACTIVE_LEVEL are compiled out entirely,
+// release builds set it to LogLevel::INFO.
+#ifndef LOG_ACTIVE_LEVEL
+#define LOG_ACTIVE_LEVEL LogLevel::DEBUG
+#endif
+
+// The arguments are only evaluated and formatted once the level gate
+// passed, the message is a std::format string:
+//     LOG_INFO("add client {}", fd);
+#define LOG(level, ...)                                                           \
+    do {                                                                          \
+        if constexpr (int(level) >= int(LOG_ACTIVE_LEVEL)) {                      \
+            if (LogManager::Enabled(level)) {                                     \
+                static LogSite const log_site_(                                   \
+                    std::source_location::current(),                              \
+                    LOG_FORMAT_(__VA_ARGS__, ""));                                \
+                auto const log_event_ = LogEvent::Make(log_site_, __VA_ARGS__);   \
+                if (LogLimiter::Admit(level, log_site_, log_event_, nullptr))     \
+                    LogManager::Log(level, log_event_);                           \
+            }                                                                     \
+        }                                                                         \
+    } while (0)
+
+// Logs under a logger name, reaching the appenders of that logger and
+// its ancestors only:
+//     LOG_TO("http.access", LogLevel::INFO, "{} {}", method, path);
+#define LOG_TO(name, level, ...)                                                  \
+    do {                                                                          \
+        if constexpr (int(level) >= int(LOG_ACTIVE_LEVEL)) {                      \
+            static LogRoute const& log_route_ =                                   \
+                LogManager::Instance().Route(name);                               \
+            if (log_route_.Enabled(level)) {                                      \
+                static LogSite const log_site_(                                   \
+                    std::source_location::current(),                              \
+                    LOG_FORMAT_(__VA_ARGS__, ""));                                \
+                auto const log_event_ = LogEvent::Make(log_site_, __VA_ARGS__);   \
+                if (LogLimiter::Admit(level, log_site_, log_event_, &log_route_)) \
+                    log_route_.Log(level, log_event_);                            \
+            }                                                                     \
+        }                                                                         \
+    } while (0)
+
+#define LOG_FORMAT_(format, ...) format
+
+#define LOG_DEBUG(...) LOG(LogLevel::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG(LogLevel::INFO, __VA_ARGS__)
+#define LOG_WARN(...)  LOG(LogLevel::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(LogLevel::ERROR, __VA_ARGS__)
+#define LOG_FATAL(...) LOG(LogLevel::FATAL, __VA_ARGS__)
 
 #endif // __LOG__H_
\ No newline at end of file
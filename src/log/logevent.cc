@@ -1,4 +1,14 @@
 #include "log.hh"
 
+LogSite::LogSite(std::source_location const& location, std::string_view format) :
+    file_(location.file_name()),
+    func_name_(location.function_name()),
+    line_(location.line()),
+    format_(format)
+{
+    static std::atomic<uint32_t> count;
+    id_ = ++count;
+}
+
 LogInfo::LogInfo(Logger const* logger, LogLevel level) :
-    logger_name_(logger->Name()), level_(level) { }
\ No newline at end of file
+    logger_name_(logger->Name()), logger_id_(logger->Id()), level_(level) { }
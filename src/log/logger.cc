@@ -1,21 +1,56 @@
 #include "log.hh"
 
 Logger::Logger(LogLevel level, std::string_view name) :
-    level_(level), name_(name), appenders_() { }
+    level_(level), name_(name), appenders_()
+{
+    static std::atomic<uint32_t> count;
+    id_ = ++count;
+}
 
-void Logger::Log(LogLevel level, LogEvent::ptr event)
+void Logger::Log(LogLevel level, LogEvent const& event)
 {
     if (level < level_) return;
+
+    // every formatter runs once, appenders sharing it share the output
+    struct Formatted {
+        LogFormatter const* formatter;
+        size_t pos, len;
+    };
+    std::array<Formatted, 8> formatted;
+    size_t count = 0;
+
+    thread_local std::string buffer;
+    buffer.clear();
+
+    LogInfo info(this, level);
     for (auto& p_app : appenders_) {
-        p_app->Log(LogInfo(this, level), event);
+        if (level < p_app->Level()) continue;
+
+        auto const* formatter = p_app->Formatter().get();
+        if (!formatter) {
+            p_app->Append(info, event, {});
+            continue;
+        }
+        auto found = std::ranges::find(
+            formatted.begin(), formatted.begin() + count,
+            formatter, &Formatted::formatter);
+
+        Formatted f {formatter, buffer.size(), 0};
+        if (found != formatted.begin() + count) f = *found;
+        else {
+            formatter->Format(buffer, info, event);
+            f.len = buffer.size() - f.pos;
+            if (count < formatted.size()) formatted[count++] = f;
+        }
+        p_app->Append(info, event, std::string_view(buffer).substr(f.pos, f.len));
     }
 }
 
-void Logger::Debug(LogEvent::ptr event) { Log(LogLevel::DEBUG, event); }
-void Logger::Info(LogEvent::ptr event) { Log(LogLevel::INFO, event); }
-void Logger::Warn(LogEvent::ptr event) { Log(LogLevel::WARN, event); }
-void Logger::Error(LogEvent::ptr event) { Log(LogLevel::ERROR, event); }
-void Logger::Fatal(LogEvent::ptr event) { Log(LogLevel::FATAL, event); }
+void Logger::Debug(LogEvent const& event) { Log(LogLevel::DEBUG, event); }
+void Logger::Info(LogEvent const& event) { Log(LogLevel::INFO, event); }
+void Logger::Warn(LogEvent const& event) { Log(LogLevel::WARN, event); }
+void Logger::Error(LogEvent const& event) { Log(LogLevel::ERROR, event); }
+void Logger::Fatal(LogEvent const& event) { Log(LogLevel::FATAL, event); }
 
 void Logger::AddAppender(LogAppender::ptr appender)
 {
@@ -23,6 +58,7 @@ void Logger::AddAppender(LogAppender::ptr appender)
         if (*it == appender) return;
     }
     appenders_.emplace_front(appender);
+    LogManager::Instance().UpdateRoutes();
 }
 
 void Logger::DelAppender(LogAppender::ptr appender)
@@ -31,4 +67,20 @@ void Logger::DelAppender(LogAppender::ptr appender)
         if (*it == appender) appenders_.erase(it);
         break;
     }
+    LogManager::Instance().UpdateRoutes();
+}
+
+void Logger::SetLevel(LogLevel level)
+{
+    level_ = level;
+    LogManager::Instance().UpdateRoutes();
+}
+
+auto Logger::EffectiveLevel() const -> int
+{
+    int level = LogLevel::FATAL + 1;
+    for (auto const& p_app : appenders_) {
+        level = std::min(level, int(p_app->Level()));
+    }
+    return std::max(level, int(level_));
 }
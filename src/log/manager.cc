@@ -51,11 +51,79 @@ void LogManager::DelAppender(std::string_view name)
 void LogManager::AddLogger(Logger::ptr logger)
 {
     loggers_.emplace(logger->Name(), logger);
+    UpdateRoutes();
 }
 
 void LogManager::DelLogger(Logger::ptr logger)
 {
     loggers_.erase(logger->Name());
+    UpdateRoutes();
+}
+
+auto LogManager::Route(std::string_view name) -> LogRoute&
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    auto found = routes_.find(name);
+    if (found == routes_.end()) {
+        found = routes_.emplace(name, new LogRoute(name)).first;
+        auto& route = *found->second;
+        route.Update(Targets_(name, &route.logger_));
+    }
+    return *found->second;
+}
+
+void LogManager::SetRecorder(LogAppender::ptr recorder)
+{
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        recorder_ = recorder;
+    }
+    UpdateRoutes();
+}
+
+void LogManager::UpdateRoutes()
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    all_.Update(Targets_("", nullptr));
+    for (auto& [name, route] : routes_) {
+        route->Update(Targets_(name, &route->logger_));
+    }
+}
+
+// an empty name collects every logger, each keeping its own name;
+// otherwise the logger of that name, its ancestors and root, all
+// formatted as logger
+auto LogManager::Targets_(std::string_view name, Logger const* logger) const
+    -> LogRoute::targets_t
+{
+    LogRoute::targets_t targets;
+    auto add = [&](Logger const& owner) {
+        for (auto const& appender : owner.Appenders()) {
+            int level = std::max(int(owner.Level()), int(appender->Level()));
+            auto found = std::ranges::find(targets, appender, &LogRoute::Target::appender);
+            if (found != targets.end()) found->level = std::min(found->level, level);
+            else targets.push_back({appender, logger ? logger : &owner, level});
+        }
+    };
+
+    if (name.empty()) {
+        for (auto const& owner : loggers_ | std::views::values) add(*owner);
+    } else {
+        for (auto prefix = name; !prefix.empty();) {
+            if (auto owner = GetLogger(prefix)) add(*owner);
+            auto dot = prefix.rfind('.');
+            prefix = prefix.substr(0, dot == std::string_view::npos ? 0 : dot);
+        }
+        if (name != Logger::default_name) {
+            if (auto root = GetLogger(Logger::default_name)) add(*root);
+        }
+    }
+
+    if (recorder_) {
+        targets.push_back({recorder_, logger ? logger : &all_.logger_,
+                           int(recorder_->Level())});
+    }
+    return targets;
 }
 
 auto LogManager::GetFormatter(std::string_view name) const -> LogFormatter::ptr
@@ -0,0 +1,280 @@
+#ifndef __LOG_PATTERN__H_
+#define __LOG_PATTERN__H_
+
+// Included by log.hh once LogEvent and LogInfo are complete.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <format>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Per-thread cache of formatted timestamps. strftime and localtime_r
+// only run when the second changes for a given format, milliseconds
+// are appended to the cached text.
+class LogTimeCache
+{
+    struct Entry {
+        char const* format = nullptr;
+        time_t second = -1;
+        size_t len = 0;
+        char text[128];
+    };
+
+public:
+    // format must be null-terminated and outlive the cache entry,
+    // entries are keyed by its address; slot separates clocks that
+    // share a format (wall time and elapsed time)
+    static void Format(std::string& out, int64_t ms,
+                       char const* format, bool millis, int slot = 0)
+    {
+        auto& entry = Lookup_(format, slot);
+
+        time_t second = ms / 1000;
+        if (entry.format != format || entry.second != second) {
+            std::tm tm;
+            ::localtime_r(&second, &tm);
+            entry.format = format;
+            entry.second = second;
+            entry.len = std::strftime(entry.text, sizeof(entry.text), format, &tm);
+        }
+        out.append(entry.text, entry.len);
+
+        if (millis) {
+            int m = ms % 1000;
+            char const digits[] {'.', char('0' + m / 100),
+                                 char('0' + m / 10 % 10), char('0' + m % 10)};
+            out.append(digits, sizeof(digits));
+        }
+    }
+
+private:
+    static auto Lookup_(char const* format, int slot) -> Entry&
+    {
+        thread_local std::array<Entry, 8> entries;
+        auto hash = (reinterpret_cast<uintptr_t>(format) >> 3) ^ slot;
+        return entries[hash % entries.size()];
+    }
+};
+
+// Formats a single pattern field, shared by the runtime items of
+// LogFormatter and the segments of StaticLogFormatter.
+struct LogField {
+    static void Message(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        out.append(event.Content());
+    }
+    static void Level(std::string& out, LogInfo const& info, LogEvent const&)
+    {
+        out.append(std::string_view(info.Level()));
+    }
+    static void Name(std::string& out, LogInfo const& info, LogEvent const&)
+    {
+        out.append(info.Name());
+    }
+    static void FuncName(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        out.append(event.FuncName());
+    }
+    static void ElapseTime(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        LogTimeCache::Format(out, event.ElapsedMs(), default_time_format, false, 1);
+    }
+    static void ThreadId(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        std::format_to(std::back_inserter(out), "{}", event.ThreadId());
+    }
+    static void FiberId(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        std::format_to(std::back_inserter(out), "{}", event.FiberId());
+    }
+    static void File(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        out.append(event.File());
+    }
+    static void Line(std::string& out, LogInfo const&, LogEvent const& event)
+    {
+        std::format_to(std::back_inserter(out), "{}", event.Line());
+    }
+
+    // format must be null-terminated, %d and %D with milliseconds
+    static void Time(std::string& out, LogEvent const& event,
+                     char const* format, bool millis)
+    {
+        LogTimeCache::Format(out, event.TimeMs(), format, millis);
+    }
+
+    static constexpr char const* default_time_format = "%Y:%m:%d %H:%M:%S";
+};
+
+// ----------------------------
+//  Compile-time log patterns
+// ----------------------------
+
+template <size_t N>
+struct LogPattern {
+    constexpr LogPattern(char const (&str)[N]) { std::copy_n(str, N, str_); }
+
+    constexpr auto View() const
+        -> std::string_view { return {str_, N - 1}; }
+
+    char str_[N];
+};
+
+struct LogSegment {
+    enum Kind {
+        TEXT = 0,
+        LINE_FEED,
+        TAB,
+        MESSAGE,
+        LEVEL,
+        NAME,
+        FUNC_NAME,
+        ELAPSE_TIME,
+        THREAD_ID,
+        TIME,
+        TIME_MS,
+        FILE,
+        LINE,
+    };
+
+    Kind kind;
+    // the text of TEXT, the {format} of TIME(_MS), into the pattern
+    size_t pos, len;
+};
+
+// Same grammar as LogFormatter::ParsePattern: '%', a character and
+// the alphanumerics after it, then an optional {format}. Unknown
+// placeholders fail to compile instead of printing an error marker.
+template <typename Callback>
+constexpr void ParseLogPattern(std::string_view pattern, Callback&& callback)
+{
+    auto text = [&](size_t pos, size_t len) {
+        if (len) callback(LogSegment {LogSegment::TEXT, pos, len});
+    };
+
+    size_t i = 0, start = 0;
+    while (i < pattern.size()) {
+        if (pattern[i] != '%') {
+            ++i;
+            continue;
+        }
+        text(start, i - start);
+        if (++i == pattern.size()) return;
+
+        size_t end = i + 1;
+        while (end < pattern.size() &&
+               (('0' <= pattern[end] && pattern[end] <= '9') ||
+                ('a' <= pattern[end] && pattern[end] <= 'z') ||
+                ('A' <= pattern[end] && pattern[end] <= 'Z')))
+            ++end;
+        auto placeholder = pattern.substr(i, end - i);
+        size_t const at = i;
+
+        size_t fmt_pos = end, fmt_len = 0;
+        if (end < pattern.size() && pattern[end] == '{') {
+            fmt_pos = end + 1;
+            end = pattern.find('}', fmt_pos);
+            if (end == std::string_view::npos) end = pattern.size();
+            fmt_len = end - fmt_pos;
+            end = std::min(end + 1, pattern.size());
+        }
+        i = start = end;
+
+        if (placeholder == "%") text(at, 1);
+        else if (placeholder == "n") callback(LogSegment {LogSegment::LINE_FEED, 0, 0});
+        else if (placeholder == "T") callback(LogSegment {LogSegment::TAB, 0, 0});
+        else if (placeholder == "m") callback(LogSegment {LogSegment::MESSAGE, 0, 0});
+        else if (placeholder == "p") callback(LogSegment {LogSegment::LEVEL, 0, 0});
+        else if (placeholder == "c") callback(LogSegment {LogSegment::NAME, 0, 0});
+        else if (placeholder == "x") callback(LogSegment {LogSegment::FUNC_NAME, 0, 0});
+        else if (placeholder == "r") callback(LogSegment {LogSegment::ELAPSE_TIME, 0, 0});
+        else if (placeholder == "t") callback(LogSegment {LogSegment::THREAD_ID, 0, 0});
+        else if (placeholder == "f") callback(LogSegment {LogSegment::FILE, 0, 0});
+        else if (placeholder == "l") callback(LogSegment {LogSegment::LINE, 0, 0});
+        else if (placeholder == "d") callback(LogSegment {LogSegment::TIME, fmt_pos, fmt_len});
+        else if (placeholder == "D") callback(LogSegment {LogSegment::TIME_MS, fmt_pos, fmt_len});
+        else throw std::invalid_argument("invalid log pattern placeholder");
+    }
+    text(start, i - start);
+}
+
+template <LogPattern P>
+class StaticLogFormatter
+{
+    static constexpr auto count_ = [] {
+        size_t n = 0;
+        ParseLogPattern(P.View(), [&](LogSegment) { ++n; });
+        return n;
+    }();
+
+    static constexpr auto segments_ = [] {
+        std::array<LogSegment, count_> segments {};
+        size_t n = 0;
+        ParseLogPattern(P.View(), [&](LogSegment s) { segments[n++] = s; });
+        return segments;
+    }();
+
+    // null-terminated copy of a {format}, strftime needs one
+    template <LogSegment S>
+    static constexpr auto time_format_ = [] {
+        constexpr auto view = S.len
+                                ? P.View().substr(S.pos, S.len)
+                                : std::string_view(LogField::default_time_format);
+        std::array<char, view.size() + 1> format {};
+        std::ranges::copy(view, format.begin());
+        return format;
+    }();
+
+    template <LogSegment S>
+    static void FormatSegment(
+        std::string& out, LogInfo const& info, LogEvent const& event)
+    {
+        if constexpr (S.kind == LogSegment::TEXT) {
+            out.append(P.View().substr(S.pos, S.len));
+        } else if constexpr (S.kind == LogSegment::LINE_FEED) {
+            out.push_back('\n');
+        } else if constexpr (S.kind == LogSegment::TAB) {
+            out.push_back('\t');
+        } else if constexpr (S.kind == LogSegment::MESSAGE) {
+            LogField::Message(out, info, event);
+        } else if constexpr (S.kind == LogSegment::LEVEL) {
+            LogField::Level(out, info, event);
+        } else if constexpr (S.kind == LogSegment::NAME) {
+            LogField::Name(out, info, event);
+        } else if constexpr (S.kind == LogSegment::FUNC_NAME) {
+            LogField::FuncName(out, info, event);
+        } else if constexpr (S.kind == LogSegment::ELAPSE_TIME) {
+            LogField::ElapseTime(out, info, event);
+        } else if constexpr (S.kind == LogSegment::THREAD_ID) {
+            LogField::ThreadId(out, info, event);
+        } else if constexpr (S.kind == LogSegment::FILE) {
+            LogField::File(out, info, event);
+        } else if constexpr (S.kind == LogSegment::LINE) {
+            LogField::Line(out, info, event);
+        } else if constexpr (S.kind == LogSegment::TIME) {
+            LogField::Time(out, event, time_format_<S>.data(), false);
+        } else if constexpr (S.kind == LogSegment::TIME_MS) {
+            LogField::Time(out, event, time_format_<S>.data(), true);
+        }
+    }
+
+public:
+    static void Format(
+        std::string& out, LogInfo const& info, LogEvent const& event)
+    {
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            (FormatSegment<segments_[I]>(out, info, event), ...);
+        }(std::make_index_sequence<count_>());
+    }
+
+    static constexpr auto Segments() { return segments_; }
+};
+
+#endif // __LOG_PATTERN__H_
@@ -0,0 +1,317 @@
+#ifndef __LOG_RECORD__H_
+#define __LOG_RECORD__H_
+
+// Typed log arguments and the binary record layout, shared by the
+// logging hot path, BinaryLogAppender and logcat.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <concepts>
+#include <format>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// ----------------
+//  Typed arguments
+// ----------------
+
+// Every argument is stored as a tag byte and its value, strings as a
+// 32 bit length and the bytes. Types without a tag are formatted with
+// "{}" and stored as a string.
+struct LogArg {
+    enum Tag : uint8_t {
+        I64 = 1,
+        U64,
+        F64,
+        BOOL,
+        CHAR,
+        STR,
+        PTR,
+        F32, // printed as written, not widened to double
+    };
+
+    typedef std::variant<int64_t, uint64_t, double, bool, char,
+                         std::string_view, void const*, float>
+        value_t;
+
+    template <typename T>
+    struct Traits {
+        typedef std::string_view type;
+        static constexpr Tag tag = STR;
+    };
+
+    template <typename T>
+    using type_t = typename Traits<std::remove_cvref_t<T>>::type;
+
+    typedef std::vector<std::byte> buffer_t;
+
+    template <typename T>
+    static void Encode(buffer_t& out, T const& value)
+    {
+        typedef Traits<T> traits;
+        out.push_back(std::byte(traits::tag));
+        if constexpr (traits::tag == STR) {
+            if constexpr (std::convertible_to<T const&, std::string_view>) {
+                EncodeString_(out, std::string_view(value));
+            } else {
+                // formatted in place, the arena has room already
+                uint32_t len = std::formatted_size("{}", value);
+                Append_(out, &len, sizeof(len));
+                size_t offset = out.size();
+                out.resize(offset + len);
+                std::format_to_n((char*)out.data() + offset, len, "{}", value);
+            }
+        } else {
+            auto v = static_cast<typename traits::type>(value);
+            Append_(out, &v, sizeof(v));
+        }
+    }
+
+    template <typename T>
+    static auto Decode(std::byte const*& p) -> T
+    {
+        ++p; // the tag is known from the type
+        if constexpr (std::is_same_v<T, std::string_view>) {
+            uint32_t len;
+            std::memcpy(&len, p, sizeof(len));
+            p += sizeof(len);
+            std::string_view s((char const*)p, len);
+            p += len;
+            return s;
+        } else {
+            T v;
+            std::memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+            return v;
+        }
+    }
+
+    // decodes one argument without knowing its type, false at the end
+    // of the span or on a malformed value
+    static auto Next(std::span<std::byte const>& args, value_t& value) -> bool
+    {
+        if (args.empty()) return false;
+        auto p = args.data();
+        auto tag = Tag(*p);
+        size_t size = 1 + SizeOf_(tag);
+        if (tag == STR && args.size() >= 5) {
+            uint32_t len;
+            std::memcpy(&len, p + 1, sizeof(len));
+            size += len;
+        }
+        if (size == 1 || size > args.size()) return false;
+
+        switch (tag) {
+        case I64: value = Decode<int64_t>(p); break;
+        case U64: value = Decode<uint64_t>(p); break;
+        case F64: value = Decode<double>(p); break;
+        case BOOL: value = Decode<bool>(p); break;
+        case CHAR: value = Decode<char>(p); break;
+        case STR: value = Decode<std::string_view>(p); break;
+        case PTR: value = Decode<void const*>(p); break;
+        case F32: value = Decode<float>(p); break;
+        }
+        args = args.subspan(size);
+        return true;
+    }
+
+    // Renders a std::format string with arguments of any type, as the
+    // types are only known from the tags. Supports {}, {n} and specs.
+    static void Render(std::string& out, std::string_view fmt,
+                       std::span<std::byte const> args)
+    {
+        std::vector<value_t> values;
+        value_t value;
+        while (Next(args, value)) values.push_back(value);
+
+        size_t next = 0;
+        std::string spec;
+        for (size_t i = 0; i < fmt.size(); ++i) {
+            char c = fmt[i];
+            if ((c == '{' || c == '}') && i + 1 < fmt.size() && fmt[i + 1] == c) {
+                out.push_back(c);
+                ++i;
+                continue;
+            }
+            if (c != '{') {
+                out.push_back(c);
+                continue;
+            }
+
+            size_t end = fmt.find('}', i);
+            if (end == std::string_view::npos) end = fmt.size();
+            auto field = fmt.substr(i + 1, end - i - 1);
+            i = end;
+
+            auto colon = field.find(':');
+            auto index = field.substr(0, colon);
+            size_t n = next++;
+            if (!index.empty()) {
+                n = 0;
+                for (char d : index) n = n * 10 + (d - '0');
+            }
+            if (n >= values.size()) {
+                out.append("{?}");
+                continue;
+            }
+
+            spec = "{";
+            if (colon != std::string_view::npos) spec.append(field.substr(colon));
+            spec.push_back('}');
+            std::visit([&](auto const& v) {
+                try {
+                    std::vformat_to(std::back_inserter(out), spec,
+                                    std::make_format_args(v));
+                } catch (std::format_error const&) {
+                    std::format_to(std::back_inserter(out), "{}", v);
+                }
+            },
+                       values[n]);
+        }
+    }
+
+private:
+    static void Append_(buffer_t& out, void const* p, size_t size)
+    {
+        auto b = (std::byte const*)p;
+        out.insert(out.end(), b, b + size);
+    }
+
+    static void EncodeString_(buffer_t& out, std::string_view s)
+    {
+        uint32_t len = s.size();
+        Append_(out, &len, sizeof(len));
+        Append_(out, s.data(), s.size());
+    }
+
+    static constexpr auto SizeOf_(Tag tag) -> size_t
+    {
+        switch (tag) {
+        case I64:
+        case U64:
+        case F64:
+        case PTR: return 8;
+        case F32: return 4;
+        case BOOL:
+        case CHAR: return 1;
+        case STR: return 4;
+        }
+        return 0;
+    }
+};
+
+template <>
+struct LogArg::Traits<bool> {
+    typedef bool type;
+    static constexpr LogArg::Tag tag = LogArg::BOOL;
+};
+
+template <>
+struct LogArg::Traits<char> {
+    typedef char type;
+    static constexpr LogArg::Tag tag = LogArg::CHAR;
+};
+
+template <std::signed_integral T>
+struct LogArg::Traits<T> {
+    typedef int64_t type;
+    static constexpr LogArg::Tag tag = LogArg::I64;
+};
+
+template <std::unsigned_integral T>
+struct LogArg::Traits<T> {
+    typedef uint64_t type;
+    static constexpr LogArg::Tag tag = LogArg::U64;
+};
+
+template <std::floating_point T>
+struct LogArg::Traits<T> {
+    typedef double type;
+    static constexpr LogArg::Tag tag = LogArg::F64;
+};
+
+template <>
+struct LogArg::Traits<float> {
+    typedef float type;
+    static constexpr LogArg::Tag tag = LogArg::F32;
+};
+
+template <typename T>
+    requires std::is_pointer_v<T> &&
+             (!std::convertible_to<T, std::string_view>)
+struct LogArg::Traits<T> {
+    typedef void const* type;
+    static constexpr LogArg::Tag tag = LogArg::PTR;
+};
+
+// ----------------
+//  Binary records
+// ----------------
+
+// A segment starts with LogSegmentHeader, records follow at 8 byte
+// alignment. A record is committed by storing its size last, a zero
+// size ends the segment.
+struct LogSegmentHeader {
+    static constexpr char MAGIC[8] = {'W', 'S', 'B', 'L', 'O', 'G', '\0', '\1'};
+
+    char magic[8];
+    uint32_t header_size;
+    uint32_t pid;
+    int64_t start_time; // LogManager::StartTime, ms
+    int64_t created;    // ms
+};
+
+struct LogRecordHeader {
+    enum Type : uint16_t {
+        EVENT = 1,
+        SITE,   // defines a source location id, once per segment
+        LOGGER, // defines a logger id, once per segment
+    };
+
+    uint32_t size; // of the whole record with padding
+    uint16_t type;
+    uint16_t len;  // EVENT: level, SITE/LOGGER: unused
+    uint32_t id;   // EVENT: site id, SITE/LOGGER: the defined id
+    uint32_t aux;  // EVENT: logger id, SITE: line
+};
+
+// followed by the typed arguments
+struct LogEventRecord {
+    LogRecordHeader header;
+    int64_t time;    // ms
+    int64_t elapsed; // ms
+    uint64_t fiber_id;
+    int32_t thread_id;
+    uint32_t args_size;
+};
+
+// followed by file, function name and format string
+struct LogSiteRecord {
+    LogRecordHeader header;
+    uint32_t file_size;
+    uint32_t func_size;
+    uint32_t format_size;
+    uint32_t reserved;
+};
+
+// followed by the logger name
+struct LogLoggerRecord {
+    LogRecordHeader header;
+    uint32_t name_size;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(LogRecordHeader) % 8 == 0);
+static_assert(sizeof(LogEventRecord) % 8 == 0);
+static_assert(sizeof(LogSiteRecord) % 8 == 0);
+static_assert(sizeof(LogLoggerRecord) % 8 == 0);
+
+#endif // __LOG_RECORD__H_
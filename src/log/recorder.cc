@@ -0,0 +1,325 @@
+#include "log.hh"
+
+#include <bit>
+#include <csignal>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+struct LogRecorder::Slot {
+    static constexpr size_t ARGS_SIZE = 192;
+
+    // odd while the owner thread writes the slot
+    std::atomic<uint32_t> seq;
+    uint16_t level;
+    uint16_t args_size;
+    LogSite const* site;
+    char const* logger_name;
+    uint32_t logger_size;
+    uint32_t logger_id;
+    int64_t time;
+    int64_t elapsed;
+    uint64_t fiber_id;
+    int32_t thread_id;
+    std::byte args[ARGS_SIZE];
+};
+
+struct LogRecorder::Ring {
+    Ring(size_t size) :
+        head(0), slots(new Slot[size]()) { }
+
+    std::atomic<uint64_t> head; // events written so far
+    std::unique_ptr<Slot[]> slots;
+};
+
+// Buffers records for the dump, everything it touches is static.
+class LogRecorder::Writer
+{
+    static constexpr size_t MAX_SITES = 1 << 16;
+    static constexpr size_t MAX_LOGGERS = 1 << 12;
+
+public:
+    Writer(int fd) :
+        fd_(fd), len_(0)
+    {
+        std::memset(sites_, 0, sizeof(sites_));
+        std::memset(loggers_, 0, sizeof(loggers_));
+    }
+
+    ~Writer() { Flush(); }
+
+    void Put(void const* data, size_t size)
+    {
+        auto p = static_cast<char const*>(data);
+        while (size) {
+            if (len_ == sizeof(buffer_)) Flush();
+            size_t n = std::min(size, sizeof(buffer_) - len_);
+            std::memcpy(buffer_ + len_, p, n);
+            len_ += n;
+            p += n;
+            size -= n;
+        }
+    }
+
+    void Record(LogRecordHeader header, void const* fixed, size_t fixed_size,
+                std::initializer_list<std::string_view> payload)
+    {
+        size_t size = sizeof(header) + fixed_size;
+        for (auto part : payload) size += part.size();
+        header.size = (size + 7) & ~size_t(7);
+
+        Put(&header, sizeof(header));
+        Put(fixed, fixed_size);
+        for (auto part : payload) Put(part.data(), part.size());
+        static constexpr char zeros[8] = {};
+        Put(zeros, header.size - size);
+    }
+
+    // defines the site and logger of a slot once per dump
+    void Define(Slot const& slot)
+    {
+        if (slot.site && Claim(sites_, MAX_SITES, slot.site->Id())) {
+            auto const* site = slot.site;
+            LogSiteRecord record {};
+            record.header.type = LogRecordHeader::SITE;
+            record.header.id = site->Id();
+            record.header.aux = site->Line();
+            record.file_size = site->File().size();
+            record.func_size = site->FuncName().size();
+            record.format_size = site->Format().size();
+            Record(record.header, &record.file_size, sizeof(record) - sizeof(record.header),
+                   {site->File(), site->FuncName(), site->Format()});
+        }
+        if (Claim(loggers_, MAX_LOGGERS, slot.logger_id)) {
+            LogLoggerRecord record {};
+            record.header.type = LogRecordHeader::LOGGER;
+            record.header.id = slot.logger_id;
+            record.name_size = slot.logger_size;
+            Record(record.header, &record.name_size, sizeof(record) - sizeof(record.header),
+                   {std::string_view(slot.logger_name, slot.logger_size)});
+        }
+    }
+
+    void Flush()
+    {
+        size_t done = 0;
+        while (done < len_) {
+            ssize_t n = ::write(fd_, buffer_ + done, len_ - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        len_ = 0;
+    }
+
+private:
+    static auto Claim(uint64_t* bits, size_t max, uint32_t id) -> bool
+    {
+        if (id >= max) return true;
+        uint64_t mask = uint64_t(1) << (id % 64);
+        bool first = !(bits[id / 64] & mask);
+        bits[id / 64] |= mask;
+        return first;
+    }
+
+    int fd_;
+    size_t len_;
+    char buffer_[64 << 10];
+    uint64_t sites_[MAX_SITES / 64];
+    uint64_t loggers_[MAX_LOGGERS / 64];
+};
+
+namespace
+{
+// leaked, the signal handler may run during static destruction
+std::atomic<LogRecorder*> active_recorder;
+
+auto FormatNumber(char* out, uint64_t n) -> size_t
+{
+    char digits[24];
+    size_t len = 0;
+    do digits[len++] = char('0' + n % 10);
+    while (n /= 10);
+    for (size_t i = 0; i < len; ++i) out[i] = digits[len - 1 - i];
+    return len;
+}
+} // namespace
+
+auto LogRecorder::Install(Options const& options) -> ptr
+{
+    static auto* recorder = new ptr(new LogRecorder(options));
+    auto& r = **recorder;
+
+    r.SetLevel(options.level);
+    auto prefix = std::format("{}.{}.", options.path, ::getpid());
+    prefix.resize(std::min(prefix.size(), sizeof(r.path_) - 24));
+    std::memcpy(r.path_, prefix.c_str(), prefix.size() + 1);
+
+    if (options.signals) {
+        struct ::sigaction action {};
+        action.sa_handler = &OnSignal_;
+        ::sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        ::sigaction(SIGUSR2, &action, nullptr);
+
+        // fatal ones run once, then the default action takes over
+        action.sa_flags = SA_RESETHAND | SA_NODEFER;
+        for (int sig : {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL}) {
+            ::sigaction(sig, &action, nullptr);
+        }
+    }
+
+    LogManager::Instance().SetRecorder(*recorder);
+    return *recorder;
+}
+
+LogRecorder::LogRecorder(Options const& options) :
+    LogAppender(options.level, nullptr),
+    size_(std::bit_ceil(std::max(options.size, size_t(16)))),
+    path_(), dumps_(0), ring_count_(0), rings_()
+{
+    active_recorder.store(this);
+}
+
+LogRecorder::~LogRecorder()
+{
+    active_recorder.store(nullptr);
+}
+
+void LogRecorder::Append(
+    LogInfo const& info, LogEvent const& event, std::string_view text)
+{
+    auto* ring = LocalRing_();
+    if (!ring) return;
+
+    auto head = ring->head.load(std::memory_order_relaxed);
+    auto& slot = ring->slots[head & (size_ - 1)];
+    auto seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.level = int(info.Level());
+    slot.site = event.Site();
+    slot.logger_name = info.Name().data();
+    slot.logger_size = info.Name().size();
+    slot.logger_id = info.LoggerId();
+    slot.time = event.TimeMs();
+    slot.elapsed = event.ElapsedMs();
+    slot.fiber_id = event.FiberId();
+    slot.thread_id = event.ThreadId();
+
+    if (event.Site()) {
+        // arguments too large for a slot are dropped, the format stays
+        auto args = event.Arguments();
+        slot.args_size = args.size() <= Slot::ARGS_SIZE ? args.size() : 0;
+        std::memcpy(slot.args, args.data(), slot.args_size);
+    } else {
+        // already formatted, kept as one possibly truncated string
+        auto content = event.Content().substr(0, Slot::ARGS_SIZE - 5);
+        uint32_t len = content.size();
+        slot.args[0] = std::byte(LogArg::STR);
+        std::memcpy(slot.args + 1, &len, sizeof(len));
+        std::memcpy(slot.args + 5, content.data(), len);
+        slot.args_size = 5 + len;
+    }
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+auto LogRecorder::Dump() -> bool
+{
+    if (dumping_.test_and_set(std::memory_order_acquire)) return false;
+
+    char path[sizeof(path_)];
+    size_t len = std::strlen(path_);
+    std::memcpy(path, path_, len);
+    len += FormatNumber(path + len, dumps_.fetch_add(1));
+    path[len] = '\0';
+
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        dumping_.clear(std::memory_order_release);
+        return false;
+    }
+
+    ::timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+
+    {
+        // too large for a signal stack
+        alignas(Writer) static char storage[sizeof(Writer)];
+        auto* writer = new (storage) Writer(fd);
+
+        LogSegmentHeader header {};
+        std::memcpy(header.magic, LogSegmentHeader::MAGIC, sizeof(header.magic));
+        header.header_size = (sizeof(header) + 7) & ~size_t(7);
+        header.pid = ::getpid();
+        header.start_time = LogManager::Instance().StartTime();
+        header.created = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        writer->Put(&header, sizeof(header));
+        static constexpr char zeros[8] = {};
+        writer->Put(zeros, header.header_size - sizeof(header));
+
+        // thread by thread, oldest first; slots rewritten meanwhile
+        // are skipped
+        Slot slot;
+        size_t count = std::min(ring_count_.load(), MAX_THREADS);
+        for (size_t r = 0; r < count; ++r) {
+            auto* ring = rings_[r].load(std::memory_order_acquire);
+            if (!ring) continue;
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            for (uint64_t i = head > size_ ? head - size_ : 0; i < head; ++i) {
+                auto& from = ring->slots[i & (size_ - 1)];
+                auto seq = from.seq.load(std::memory_order_acquire);
+                if (seq & 1) continue;
+                std::memcpy((void*)&slot, (void const*)&from, sizeof(slot));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (from.seq.load(std::memory_order_relaxed) != seq) continue;
+
+                writer->Define(slot);
+
+                LogEventRecord record {};
+                record.header.type = LogRecordHeader::EVENT;
+                record.header.len = slot.level;
+                record.header.id = slot.site ? slot.site->Id() : 0;
+                record.header.aux = slot.logger_id;
+                record.time = slot.time;
+                record.elapsed = slot.elapsed;
+                record.fiber_id = slot.fiber_id;
+                record.thread_id = slot.thread_id;
+                record.args_size = slot.args_size;
+                writer->Record(record.header, &record.time,
+                               sizeof(record) - sizeof(record.header),
+                               {std::string_view((char const*)slot.args, slot.args_size)});
+            }
+        }
+        writer->~Writer();
+    }
+
+    ::close(fd);
+    dumping_.clear(std::memory_order_release);
+    return true;
+}
+
+auto LogRecorder::LocalRing_() -> Ring*
+{
+    thread_local Ring* ring = [this]() -> Ring* {
+        size_t index = ring_count_.fetch_add(1);
+        if (index >= MAX_THREADS) return nullptr;
+        auto* ring = new Ring(size_);
+        rings_[index].store(ring, std::memory_order_release);
+        return ring;
+    }();
+    return ring;
+}
+
+void LogRecorder::OnSignal_(int sig)
+{
+    int saved = errno;
+    if (auto* recorder = active_recorder.load()) recorder->Dump();
+    errno = saved;
+
+    // the handler was reset, the default action ends the process
+    if (sig != SIGUSR2) ::raise(sig);
+}
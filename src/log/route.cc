@@ -0,0 +1,61 @@
+#include "log.hh"
+
+LogRoute::LogRoute(std::string_view name) :
+    logger_(LogLevel::UNKNOWN, name),
+    level_(LogLevel::FATAL + 1), targets_(nullptr)
+{
+    Update({});
+}
+
+void LogRoute::Log(LogLevel level, LogEvent const& event) const
+{
+    // every formatter runs once, appenders sharing it share the output;
+    // name dependent output is shared per logger only
+    struct Formatted {
+        LogFormatter const* formatter;
+        Logger const* logger;
+        size_t pos, len;
+    };
+    std::array<Formatted, 8> formatted;
+    size_t count = 0;
+
+    thread_local std::string buffer;
+    buffer.clear();
+
+    for (auto const& target : *targets_.load(std::memory_order_acquire)) {
+        if (int(level) < target.level) continue;
+
+        LogInfo info(target.logger, level);
+        auto const* formatter = target.appender->Formatter().get();
+        if (!formatter) {
+            target.appender->Append(info, event, {});
+            continue;
+        }
+
+        auto const* logger = formatter->UsesName() ? target.logger : nullptr;
+        auto found = std::ranges::find_if(
+            formatted.begin(), formatted.begin() + count,
+            [&](Formatted const& f) {
+                return f.formatter == formatter && f.logger == logger;
+            });
+
+        Formatted f {formatter, logger, buffer.size(), 0};
+        if (found != formatted.begin() + count) f = *found;
+        else {
+            formatter->Format(buffer, info, event);
+            f.len = buffer.size() - f.pos;
+            if (count < formatted.size()) formatted[count++] = f;
+        }
+        target.appender->Append(info, event, std::string_view(buffer).substr(f.pos, f.len));
+    }
+}
+
+void LogRoute::Update(targets_t&& targets)
+{
+    int level = LogLevel::FATAL + 1;
+    for (auto const& target : targets) level = std::min(level, target.level);
+
+    auto& list = retired_.emplace_back(new targets_t(std::move(targets)));
+    targets_.store(list.get(), std::memory_order_release);
+    level_.store(level, std::memory_order_relaxed);
+}
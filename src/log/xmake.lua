@@ -1,3 +1,4 @@
 target("log")
     set_kind("static")
-    add_files("*.cc")
\ No newline at end of file
+    add_files("*.cc")
+    add_packages("zlib")
@@ -0,0 +1,138 @@
+// Decodes segments written by BinaryLogAppender into text:
+//     logcat [-p pattern] segment...
+// The pattern uses the LogFormatter placeholders, the default one
+// matches the "basic" format of config.yaml.
+
+#include "log/log.hh"
+
+#include <cstdio>
+#include <unordered_map>
+
+#include <unistd.h>
+
+namespace
+{
+constexpr std::string_view default_pattern = "[%D] [%p] [%c] [T:%t F:%f:%l X:%x] %m%n";
+
+struct Site {
+    std::string_view file, func_name, format;
+    int line;
+};
+
+// iterates the committed records of a segment, stops at the first
+// uncommitted or malformed one
+template <typename Callback>
+void ForEachRecord(std::string_view data, Callback&& callback)
+{
+    LogSegmentHeader segment;
+    std::memcpy(&segment, data.data(), sizeof(segment));
+
+    size_t offset = segment.header_size;
+    while (offset + sizeof(LogRecordHeader) <= data.size()) {
+        LogRecordHeader header;
+        std::memcpy(&header, data.data() + offset, sizeof(header));
+        if (header.size < sizeof(header) || offset + header.size > data.size())
+            return;
+        callback(header, data.data() + offset);
+        offset += header.size;
+    }
+}
+
+template <typename T>
+auto ReadRecord(char const* p) -> T
+{
+    T record;
+    std::memcpy(&record, p, sizeof(record));
+    return record;
+}
+
+auto Decode(std::string_view path, LogFormatter const& formatter) -> bool
+{
+    std::ifstream file(std::string(path), std::ios::binary);
+    if (!file) {
+        std::cerr << "logcat: cannot open " << path << std::endl;
+        return false;
+    }
+    std::string data {std::istreambuf_iterator<char>(file), {}};
+
+    if (data.size() < sizeof(LogSegmentHeader) ||
+        std::memcmp(data.data(), LogSegmentHeader::MAGIC, sizeof(LogSegmentHeader::MAGIC))) {
+        std::cerr << "logcat: " << path << " is not a log segment" << std::endl;
+        return false;
+    }
+
+    // definitions may follow the first event that uses them when
+    // several threads race, so collect them all first
+    std::unordered_map<uint32_t, Site> sites;
+    std::unordered_map<uint32_t, Logger::ptr> loggers;
+    ForEachRecord(data, [&](LogRecordHeader const& header, char const* p) {
+        if (header.type == LogRecordHeader::SITE) {
+            auto record = ReadRecord<LogSiteRecord>(p);
+            std::string_view s(p + sizeof(record), header.size - sizeof(record));
+            if (size_t(record.file_size) + record.func_size + record.format_size > s.size())
+                return;
+            sites[header.id] = {s.substr(0, record.file_size),
+                                s.substr(record.file_size, record.func_size),
+                                s.substr(record.file_size + record.func_size, record.format_size),
+                                int(header.aux)};
+        } else if (header.type == LogRecordHeader::LOGGER) {
+            auto record = ReadRecord<LogLoggerRecord>(p);
+            std::string_view name(p + sizeof(record),
+                                  std::min<size_t>(record.name_size, header.size - sizeof(record)));
+            loggers[header.id] = std::make_shared<Logger>(LogLevel::DEBUG, name);
+        }
+    });
+
+    auto unknown = std::make_shared<Logger>(LogLevel::DEBUG, "?");
+    std::string content, out;
+    ForEachRecord(data, [&](LogRecordHeader const& header, char const* p) {
+        if (header.type != LogRecordHeader::EVENT) return;
+        auto record = ReadRecord<LogEventRecord>(p);
+        if (sizeof(record) + record.args_size > header.size) return;
+        std::span<std::byte const> args((std::byte const*)p + sizeof(record), record.args_size);
+
+        Site site {"?", "?", "{}", 0};
+        if (auto it = sites.find(header.id); it != sites.end()) site = it->second;
+
+        content.clear();
+        LogArg::Render(content, site.format, args);
+
+        auto it = loggers.find(header.aux);
+        auto const& logger = it != loggers.end() ? it->second : unknown;
+
+        LogEvent event(site.file, site.func_name, site.line,
+                       record.thread_id, record.fiber_id,
+                       record.elapsed, record.time, content);
+        LogInfo info(logger.get(),
+                     static_cast<decltype(LogLevel::UNKNOWN)>(header.len));
+
+        out.clear();
+        formatter.Format(out, info, event);
+        std::fwrite(out.data(), 1, out.size(), stdout);
+    });
+    return true;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string_view pattern = default_pattern;
+
+    int opt;
+    while ((opt = ::getopt(argc, argv, "p:")) != -1) {
+        if (opt == 'p') pattern = optarg;
+        else {
+            std::cerr << "usage: " << argv[0] << " [-p pattern] segment..." << std::endl;
+            return 2;
+        }
+    }
+    if (optind == argc) {
+        std::cerr << "usage: " << argv[0] << " [-p pattern] segment..." << std::endl;
+        return 2;
+    }
+
+    LogFormatter formatter(pattern);
+    bool ok = true;
+    for (int i = optind; i < argc; ++i) ok = Decode(argv[i], formatter) && ok;
+    return ok ? 0 : 1;
+}
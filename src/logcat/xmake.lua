@@ -0,0 +1,4 @@
+target("logcat")
+    set_kind("binary")
+    add_files("*.cc")
+    add_deps("log")
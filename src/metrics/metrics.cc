@@ -0,0 +1,413 @@
+#include "segment.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <format>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log/log.hh"
+
+Metric::Metric(Type type, std::string_view name, std::string_view help,
+               std::string_view labels) :
+    type_(type), name_(name), help_(help), labels_(labels) { }
+
+void Metric::Sample_(std::string& out, std::string_view suffix,
+                     std::string_view extra_label, double value) const
+{
+    out.append(name_);
+    out.append(suffix);
+    if (!labels_.empty() || !extra_label.empty()) {
+        out.push_back('{');
+        out.append(labels_);
+        if (!labels_.empty() && !extra_label.empty()) out.push_back(',');
+        out.append(extra_label);
+        out.push_back('}');
+    }
+    std::format_to(std::back_inserter(out), " {}\n", value);
+}
+
+Counter::Counter(std::string_view name, std::string_view help,
+                 std::string_view labels) :
+    Metric(Type::COUNTER, name, help, labels), cells_()
+{
+    Metrics::Instance().Add(this);
+}
+
+Counter::~Counter()
+{
+    Metrics::Instance().Remove(this);
+}
+
+auto Counter::Value() const -> uint64_t
+{
+    uint64_t sum = 0;
+    for (auto const& cell : cells_) sum += cell.value.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Counter::Compose(std::string& out) const
+{
+    Sample_(out, "", "", double(Value()));
+}
+
+void Counter::Publish(MetricsSegmentEntry& entry, MetricsSegmentHistogram*) const
+{
+    entry.value = 0;
+    for (size_t i = 0; i < MetricShard::COUNT; ++i) {
+        entry.shards[i] = Shard(i);
+        entry.value += entry.shards[i];
+    }
+}
+
+Gauge::Gauge(std::string_view name, std::string_view help,
+             std::string_view labels) :
+    Metric(Type::GAUGE, name, help, labels), cells_()
+{
+    Metrics::Instance().Add(this);
+}
+
+Gauge::~Gauge()
+{
+    Metrics::Instance().Remove(this);
+}
+
+auto Gauge::Value() const -> int64_t
+{
+    int64_t sum = 0;
+    for (auto const& cell : cells_) sum += cell.value.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Gauge::Compose(std::string& out) const
+{
+    Sample_(out, "", "", double(Value()));
+}
+
+void Gauge::Publish(MetricsSegmentEntry& entry, MetricsSegmentHistogram*) const
+{
+    entry.value = Value();
+}
+
+GaugeFunc::GaugeFunc(std::string_view name, std::string_view help,
+                     std::function<double()> read, std::string_view labels) :
+    Metric(Type::GAUGE, name, help, labels), read_(std::move(read))
+{
+    Metrics::Instance().Add(this);
+}
+
+GaugeFunc::~GaugeFunc()
+{
+    Metrics::Instance().Remove(this);
+}
+
+void GaugeFunc::Compose(std::string& out) const
+{
+    Sample_(out, "", "", read_());
+}
+
+void GaugeFunc::Publish(MetricsSegmentEntry& entry, MetricsSegmentHistogram*) const
+{
+    entry.value = read_();
+}
+
+CounterVec::CounterVec(std::string_view name, std::string_view help,
+                       std::string_view label, size_t size) :
+    name_(name), help_(help), label_(label), counters_(size) { }
+
+CounterVec::~CounterVec()
+{
+    for (auto& counter : counters_) delete counter.load();
+}
+
+auto CounterVec::With(size_t value) -> Counter&
+{
+    value = std::min(value, counters_.size() - 1);
+    if (auto* counter = counters_[value].load(std::memory_order_acquire)) return *counter;
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    auto* counter = counters_[value].load(std::memory_order_relaxed);
+    if (!counter) {
+        counter = new Counter(name_, help_, std::format("{}=\"{}\"", label_, value));
+        counters_[value].store(counter, std::memory_order_release);
+    }
+    return *counter;
+}
+
+Histogram::Histogram(std::string_view name, std::string_view help,
+                     double scale, std::string_view labels) :
+    Metric(Type::HISTOGRAM, name, help, labels),
+    scale_(scale), shards_(new Shard[MetricShard::COUNT]())
+{
+    Metrics::Instance().Add(this);
+}
+
+Histogram::~Histogram()
+{
+    Metrics::Instance().Remove(this);
+}
+
+auto Histogram::Counts() const -> counts_t
+{
+    counts_t counts {};
+    for (size_t s = 0; s < MetricShard::COUNT; ++s) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            counts[i] += shards_[s].counts[i].load(std::memory_order_relaxed);
+        }
+    }
+    return counts;
+}
+
+auto Histogram::Sum() const -> uint64_t
+{
+    uint64_t sum = 0;
+    for (size_t s = 0; s < MetricShard::COUNT; ++s) {
+        sum += shards_[s].sum.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+auto Histogram::Percentile(counts_t const& counts, double q) -> uint64_t
+{
+    uint64_t total = 0;
+    for (auto n : counts) total += n;
+    if (!total) return 0;
+
+    auto rank = uint64_t(std::clamp(q, 0.0, 1.0) * (total - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen > rank) return i + 1 < BUCKETS ? Lower(i + 1) - 1 : Lower(i);
+    }
+    return Lower(BUCKETS - 1);
+}
+
+void Histogram::Compose(std::string& out) const
+{
+    // one bucket per power of two from 16 to 2^26, i.e. 16us to 67s
+    // for microseconds
+    constexpr int min_exp = 4, max_exp = 26;
+
+    auto const counts = Counts();
+    uint64_t cumulative = 0;
+    size_t i = 0;
+    for (int exp = min_exp; exp <= max_exp; ++exp) {
+        uint64_t const le = uint64_t(1) << exp;
+        for (; i < BUCKETS && Lower(i) < le; ++i) cumulative += counts[i];
+        Sample_(out, "_bucket", std::format("le=\"{}\"", le * scale_), double(cumulative));
+    }
+    for (; i < BUCKETS; ++i) cumulative += counts[i];
+    Sample_(out, "_bucket", "le=\"+Inf\"", double(cumulative));
+    Sample_(out, "_sum", "", Sum() * scale_);
+    Sample_(out, "_count", "", double(cumulative));
+}
+
+void Histogram::Publish(MetricsSegmentEntry& entry, MetricsSegmentHistogram* histogram) const
+{
+    entry.scale = scale_;
+    entry.value = 0;
+    if (!histogram) return;
+    histogram->counts = Counts();
+    histogram->sum = Sum();
+    for (auto n : histogram->counts) entry.value += n;
+}
+
+auto Metrics::Instance() -> Metrics&
+{
+    // never destroyed, static metrics unregister during teardown
+    static auto* metrics = new Metrics();
+    return *metrics;
+}
+
+void Metrics::Add(Metric* metric)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    metrics_.push_back(metric);
+}
+
+void Metrics::Remove(Metric* metric)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    std::erase(metrics_, metric);
+}
+
+auto Metrics::Compose() const -> std::string
+{
+    std::string out;
+
+    // samples of a name are grouped under one HELP and TYPE
+    std::lock_guard<std::mutex> locker(mtx_);
+    std::vector<Metric const*> sorted(metrics_.begin(), metrics_.end());
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](auto* a, auto* b) { return a->Name() < b->Name(); });
+
+    constexpr std::string_view type_name[] = {"counter", "gauge", "histogram"};
+    std::string_view last;
+    for (auto const* metric : sorted) {
+        if (metric->Name() != last) {
+            last = metric->Name();
+            std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n",
+                           last, metric->Help(), last, type_name[int(metric->GetType())]);
+        }
+        metric->Compose(out);
+    }
+    return out;
+}
+
+auto Metrics::Snapshot() const -> std::shared_ptr<std::string const>
+{
+    auto snapshot = snapshot_.load(std::memory_order_acquire);
+    if (!snapshot) snapshot = std::make_shared<std::string const>(Compose());
+    return snapshot;
+}
+
+void Metrics::Start(int64_t interval)
+{
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (composer_.joinable()) return;
+
+    interval = std::max(interval, int64_t(10));
+    composer_ = std::jthread([this, interval](std::stop_token token) {
+        std::mutex mtx;
+        std::condition_variable_any cond;
+        while (!token.stop_requested()) {
+            snapshot_.store(std::make_shared<std::string const>(Compose()),
+                            std::memory_order_release);
+            if (segment_) Publish_(interval);
+            std::unique_lock<std::mutex> locker(mtx);
+            cond.wait_for(locker, token, std::chrono::milliseconds(interval),
+                          [] { return false; });
+        }
+    });
+}
+
+auto Metrics::Serve(int port) -> bool
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    int optval = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    ::sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (::bind(fd, (::sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(fd, 8) < 0) {
+        LOG_ERROR("metrics: cannot listen on {}: {}", port, std::strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    // one scrape at a time, whatever the request the answer is the
+    // snapshot
+    std::thread([this, fd] {
+        char request[1024];
+        while (true) {
+            int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;
+            }
+            ::timeval tv {.tv_sec = 1, .tv_usec = 0};
+            ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            [[maybe_unused]] auto n = ::recv(client, request, sizeof(request), 0);
+
+            auto body = Snapshot();
+            auto header = std::format("HTTP/1.1 200 OK\r\n"
+                                      "Content-Type: {}\r\n"
+                                      "Content-Length: {}\r\n"
+                                      "Connection: close\r\n\r\n",
+                                      content_type, body->size());
+            ::iovec iov[] {
+                {.iov_base = header.data(),        .iov_len = header.size()},
+                {.iov_base = (void*)body->data(), .iov_len = body->size()  },
+            };
+            ::msghdr msg {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+            ::sendmsg(client, &msg, MSG_NOSIGNAL);
+            ::close(client);
+        }
+        ::close(fd);
+    }).detach();
+    LOG_INFO("metrics on port {}", port);
+    return true;
+}
+
+auto Metrics::Publish(std::string_view name) -> bool
+{
+    std::string path(name);
+    int fd = ::shm_open(path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0 || ::ftruncate(fd, sizeof(MetricsSegment)) < 0) {
+        LOG_ERROR("metrics: cannot create {}: {}", name, std::strerror(errno));
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    void* p = ::mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("metrics: cannot map {}: {}", name, std::strerror(errno));
+        return false;
+    }
+
+    // a segment left by an earlier process starts over, readers see
+    // the new pid
+    auto* segment = static_cast<MetricsSegment*>(p);
+    auto seq = segment->seq.load();
+    segment->seq.store(seq + (seq & 1 ? 1 : 2));
+    std::memcpy(segment->magic, MetricsSegment::MAGIC, sizeof(segment->magic));
+    segment->pid = ::getpid();
+    segment_ = segment;
+    LOG_INFO("metrics published to shared memory {}", name);
+    return true;
+}
+
+void Metrics::Publish_(int64_t interval)
+{
+    auto* segment = segment_;
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    auto seq = segment->seq.load(std::memory_order_relaxed);
+    segment->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t entries = 0, histograms = 0;
+    for (auto const* metric : metrics_) {
+        if (entries == MetricsSegment::MAX_ENTRIES) break;
+        auto& entry = segment->entries[entries++];
+        auto copy = [](char* to, std::string const& from, size_t size) {
+            size_t n = std::min(from.size(), size - 1);
+            std::memcpy(to, from.data(), n);
+            to[n] = '\0';
+        };
+        copy(entry.name, metric->Name(), sizeof(entry.name));
+        copy(entry.labels, metric->Labels(), sizeof(entry.labels));
+        entry.type = uint32_t(metric->GetType());
+        entry.histogram = -1;
+        std::memset(entry.shards, 0, sizeof(entry.shards));
+
+        MetricsSegmentHistogram* histogram = nullptr;
+        if (metric->GetType() == Metric::Type::HISTOGRAM &&
+            histograms < MetricsSegment::MAX_HISTOGRAMS) {
+            entry.histogram = histograms;
+            histogram = &segment->histograms[histograms++];
+        }
+        metric->Publish(entry, histogram);
+    }
+    segment->entry_count = entries;
+    segment->histogram_count = histograms;
+    segment->time = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    segment->interval = interval;
+
+    segment->seq.store(seq + 2, std::memory_order_release);
+}
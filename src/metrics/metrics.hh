@@ -0,0 +1,295 @@
+#ifndef __METRICS__H_
+#define __METRICS__H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Counters, gauges and histograms sharded per thread: every thread
+// updates its own cache line and readers sum the shards, so the
+// request path never contends on a shared counter. Metrics register
+// themselves with Metrics once constructed and leave before they are
+// destroyed; Metrics composes the Prometheus text format in the
+// background and scrapes get the last snapshot. The same thread may
+// also publish the values into shared memory for webstat.
+
+struct MetricsSegment;
+struct MetricsSegmentEntry;
+struct MetricsSegmentHistogram;
+
+class MetricShard
+{
+public:
+    static constexpr size_t COUNT = 32;
+
+    // the shard of the calling thread, threads beyond COUNT share
+    static auto Index() -> size_t
+    {
+        thread_local size_t index = next_.fetch_add(1, std::memory_order_relaxed) % COUNT;
+        return index;
+    }
+
+private:
+    static inline std::atomic<size_t> next_;
+};
+
+class Metric
+{
+public:
+    enum class Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM,
+    };
+
+    // labels in Prometheus form without braces, e.g. code="200"
+    Metric(Type type, std::string_view name, std::string_view help,
+           std::string_view labels = {});
+
+    Metric(Metric const&) = delete;
+
+    virtual ~Metric() = default;
+
+    auto GetType() const { return type_; }
+    auto const& Name() const { return name_; }
+    auto const& Help() const { return help_; }
+    auto const& Labels() const { return labels_; }
+
+    // appends the sample lines
+    virtual void Compose(std::string& out) const = 0;
+
+    // fills the values of a segment entry, histogram is null when the
+    // segment has no room left for one
+    virtual void Publish(MetricsSegmentEntry& entry,
+                         MetricsSegmentHistogram* histogram) const = 0;
+
+protected:
+    void Sample_(std::string& out, std::string_view suffix,
+                 std::string_view extra_label, double value) const;
+
+private:
+    Type type_;
+    std::string name_;
+    std::string help_;
+    std::string labels_;
+};
+
+class Counter : public Metric
+{
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> value;
+    };
+
+public:
+    Counter(std::string_view name, std::string_view help,
+            std::string_view labels = {});
+
+    ~Counter();
+
+    void Add(uint64_t n = 1)
+    {
+        cells_[MetricShard::Index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    auto Value() const -> uint64_t;
+    auto Shard(size_t i) const -> uint64_t
+    {
+        return cells_[i].value.load(std::memory_order_relaxed);
+    }
+
+    virtual void Compose(std::string& out) const override;
+    virtual void Publish(MetricsSegmentEntry& entry,
+                         MetricsSegmentHistogram* histogram) const override;
+
+private:
+    std::array<Cell, MetricShard::COUNT> cells_;
+};
+
+// An up/down counter, e.g. open connections.
+class Gauge : public Metric
+{
+    struct alignas(64) Cell {
+        std::atomic<int64_t> value;
+    };
+
+public:
+    Gauge(std::string_view name, std::string_view help,
+          std::string_view labels = {});
+
+    ~Gauge();
+
+    void Add(int64_t n = 1)
+    {
+        cells_[MetricShard::Index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    void Sub(int64_t n = 1) { Add(-n); }
+
+    auto Value() const -> int64_t;
+
+    virtual void Compose(std::string& out) const override;
+    virtual void Publish(MetricsSegmentEntry& entry,
+                         MetricsSegmentHistogram* histogram) const override;
+
+private:
+    std::array<Cell, MetricShard::COUNT> cells_;
+};
+
+// A gauge read from a callback when the snapshot is composed, for
+// values the owner already keeps (queue depth, timer size).
+class GaugeFunc : public Metric
+{
+public:
+    GaugeFunc(std::string_view name, std::string_view help,
+              std::function<double()> read, std::string_view labels = {});
+
+    ~GaugeFunc();
+
+    virtual void Compose(std::string& out) const override;
+    virtual void Publish(MetricsSegmentEntry& entry,
+                         MetricsSegmentHistogram* histogram) const override;
+
+private:
+    std::function<double()> read_;
+};
+
+// Counters of one name told apart by a small integer label, e.g.
+// requests by status code; each value's counter is made on first use.
+class CounterVec
+{
+public:
+    CounterVec(std::string_view name, std::string_view help,
+               std::string_view label, size_t size);
+
+    ~CounterVec();
+
+    auto With(size_t value) -> Counter&;
+
+private:
+    std::string name_, help_, label_;
+    std::mutex mtx_;
+    std::vector<std::atomic<Counter*>> counters_;
+};
+
+// Log-linear (HDR style) histogram of non-negative integers, usually
+// microseconds: 2^SUB_BITS buckets per power of two, so a bucket is
+// within 1/2^SUB_BITS of its values. Percentiles come from the full
+// resolution, the Prometheus output has one bucket per power of two.
+class Histogram : public Metric
+{
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_BITS = 40;
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB_COUNT;
+
+    typedef std::array<uint64_t, BUCKETS> counts_t;
+
+    // scale turns a value into the unit of the exposition, e.g. 1e-6
+    // for microseconds reported in seconds
+    Histogram(std::string_view name, std::string_view help,
+              double scale = 1, std::string_view labels = {});
+
+    ~Histogram();
+
+    void Record(uint64_t value)
+    {
+        auto& shard = shards_[MetricShard::Index()];
+        shard.counts[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // sums the shards
+    auto Counts() const -> counts_t;
+    auto Sum() const -> uint64_t;
+
+    static constexpr auto Bucket(uint64_t value) -> size_t
+    {
+        if (value < SUB_COUNT) return value;
+        int exp = std::bit_width(value) - 1;
+        if (exp > MAX_BITS) return BUCKETS - 1;
+        size_t sub = (value >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+        return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    // the smallest value of a bucket
+    static constexpr auto Lower(size_t bucket) -> uint64_t
+    {
+        if (bucket < SUB_COUNT) return bucket;
+        int exp = bucket / SUB_COUNT + SUB_BITS - 1;
+        return uint64_t(SUB_COUNT + bucket % SUB_COUNT) << (exp - SUB_BITS);
+    }
+
+    // value below which a fraction q of the samples fall
+    static auto Percentile(counts_t const& counts, double q) -> uint64_t;
+
+    virtual void Compose(std::string& out) const override;
+    virtual void Publish(MetricsSegmentEntry& entry,
+                         MetricsSegmentHistogram* histogram) const override;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> sum;
+        std::array<std::atomic<uint64_t>, BUCKETS> counts;
+    };
+
+    double scale_;
+    std::unique_ptr<Shard[]> shards_;
+};
+
+class Metrics
+{
+public:
+    static auto Instance() -> Metrics&;
+
+    void Add(Metric* metric);
+    void Remove(Metric* metric);
+
+    // composes every metric right now
+    auto Compose() const -> std::string;
+
+    // the last composed text, refreshed every interval once started
+    auto Snapshot() const -> std::shared_ptr<std::string const>;
+
+    // starts the background composer, interval in ms
+    void Start(int64_t interval);
+
+    // serves the snapshot on a port of its own, off the server threads
+    auto Serve(int port) -> bool;
+
+    // publishes every snapshot into the shared memory object name as
+    // well, before Start
+    auto Publish(std::string_view name) -> bool;
+
+    template <typename F>
+    void ForEach(F&& f) const
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        for (auto const* metric : metrics_) f(*metric);
+    }
+
+    static constexpr std::string_view content_type = "text/plain; version=0.0.4";
+
+private:
+    Metrics() = default;
+
+    mutable std::mutex mtx_;
+    std::vector<Metric*> metrics_;
+
+    void Publish_(int64_t interval);
+
+    std::atomic<std::shared_ptr<std::string const>> snapshot_;
+    MetricsSegment* segment_ = nullptr;
+    std::jthread composer_;
+};
+
+#endif // __METRICS__H_
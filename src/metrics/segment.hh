@@ -0,0 +1,45 @@
+#ifndef __METRICS_SEGMENT__H_
+#define __METRICS_SEGMENT__H_
+
+#include "metrics.hh"
+
+// Layout of the shared memory segment Metrics publishes to, read by
+// webstat. The writer makes seq odd, rewrites the snapshot and makes
+// it even again; a reader copies the segment and keeps the copy when
+// seq was even and unchanged around it.
+
+struct MetricsSegmentEntry {
+    static constexpr size_t NAME_SIZE = 96;
+    static constexpr size_t LABELS_SIZE = 64;
+
+    char name[NAME_SIZE];
+    char labels[LABELS_SIZE];
+    uint32_t type;     // Metric::Type
+    int32_t histogram; // index into histograms, -1 for none
+    double value;      // counters and gauges, the count of histograms
+    double scale;      // histograms
+    uint64_t shards[MetricShard::COUNT]; // counters, per thread shard
+};
+
+struct MetricsSegmentHistogram {
+    uint64_t sum;
+    Histogram::counts_t counts;
+};
+
+struct MetricsSegment {
+    static constexpr char MAGIC[8] = {'W', 'S', 'T', 'A', 'T', '\0', '\0', '1'};
+    static constexpr size_t MAX_ENTRIES = 256;
+    static constexpr size_t MAX_HISTOGRAMS = 16;
+
+    char magic[8];
+    std::atomic<uint64_t> seq;
+    int32_t pid;
+    uint32_t entry_count;
+    uint32_t histogram_count;
+    int64_t time;     // CLOCK_MONOTONIC ms of the snapshot
+    int64_t interval; // ms between snapshots
+    MetricsSegmentEntry entries[MAX_ENTRIES];
+    MetricsSegmentHistogram histograms[MAX_HISTOGRAMS];
+};
+
+#endif // __METRICS_SEGMENT__H_
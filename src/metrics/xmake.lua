@@ -0,0 +1,4 @@
+target("metrics")
+    set_kind("static")
+    add_files("*.cc")
+    add_deps("log")
@@ -0,0 +1,239 @@
+#include "server.hh"
+
+#include <bit>
+#include <cstdio>
+#include <format>
+#include <limits>
+
+#include <unistd.h>
+
+namespace
+{
+constexpr int64_t NONE = std::numeric_limits<int64_t>::max();
+
+// slots never used and slots of evicted IPs, neither is a TCP peer
+constexpr in_addr_t EMPTY = INADDR_ANY;
+constexpr in_addr_t EVICTED = INADDR_NONE;
+
+// slots Evict looks at per call
+constexpr size_t EVICT_STEP = 256;
+
+// a complete reply that closes the connection
+auto Refusal(std::string_view status, int retry_after, std::string_view body) -> std::string
+{
+    return std::format("HTTP/1.1 {}\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: {}\r\n"
+                       "Retry-After: {}\r\n"
+                       "Connection: close\r\n\r\n{}",
+                       status, body.size(), retry_after, body);
+}
+} // namespace
+
+Admission::Admission(AdmissionOptions const& options) :
+    options_(options),
+    target_(int64_t(options.queue_target) * 1000),
+    interval_(int64_t(std::max(options.queue_interval, 1)) * 1000),
+    response_(Refusal("503 Service Unavailable", options.retry_after, "Server Busy!\n")),
+    window_start_(0), window_min_(NONE), standing_(false),
+    resident_(0), resident_at_(0)
+{
+    if (options_.max_connections <= 0 || options_.max_connections > MAX_CONNECTIONS) {
+        options_.max_connections = MAX_CONNECTIONS;
+    }
+}
+
+void Admission::Dequeued(int64_t wait, int64_t now)
+{
+    if (!target_) return;
+    auto min = window_min_.load(std::memory_order_relaxed);
+    while (wait < min && !window_min_.compare_exchange_weak(min, wait, std::memory_order_relaxed)) { }
+
+    // the thread that ends the interval judges it
+    auto start = window_start_.load(std::memory_order_relaxed);
+    if (now - start >= interval_ &&
+        window_start_.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        standing_.store(window_min_.exchange(NONE, std::memory_order_relaxed) > target_,
+                        std::memory_order_relaxed);
+    }
+}
+
+auto Admission::Admit(int connections, int64_t now) -> Verdict
+{
+    if (connections >= options_.max_connections) return Verdict::CONNECTIONS;
+
+    // nothing left the queue for a whole interval: the pool is idle,
+    // or stuck, and the last verdict is stale either way
+    if (target_ && standing_.load(std::memory_order_relaxed) &&
+        now - window_start_.load(std::memory_order_relaxed) < 2 * interval_) {
+        return Verdict::QUEUE;
+    }
+
+    if (options_.max_memory) {
+        if (now - resident_at_ >= interval_) {
+            resident_ = Resident_();
+            resident_at_ = now;
+        }
+        if (resident_ > options_.max_memory) return Verdict::MEMORY;
+    }
+    return Verdict::ADMIT;
+}
+
+auto Admission::Resident_() const -> size_t
+{
+    size_t pages = 0;
+    if (FILE* file = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(file, "%*u %zu", &pages) != 1) pages = 0;
+        std::fclose(file);
+    }
+    return pages * ::sysconf(_SC_PAGESIZE);
+}
+
+ClientLimiter::ClientLimiter(ClientLimitOptions const& options) :
+    options_(options),
+    interval_(options.rate > 0 ? int64_t(1e6 / options.rate) : 0),
+    tolerance_(interval_ * (std::max(options.burst, uint32_t(1)) - 1)),
+    idle_(int64_t(options.idle) * 1000),
+    response_(Refusal("429 Too Many Requests", options.retry_after, "Too Many Requests\n")),
+    per_shard_(std::max<size_t>((options.capacity + SHARDS - 1) / SHARDS, 1)),
+    cursor_(0)
+{
+    // at most half full, probes stay short
+    mask_ = std::bit_ceil(per_shard_ * 2) - 1;
+    if (!Enabled()) return;
+    for (auto& shard : shards_) shard.entries.reset(new Entry[mask_ + 1]());
+}
+
+auto ClientLimiter::Connect(in_addr_t ip, int64_t now) -> Verdict
+{
+    if (ip == EMPTY || ip == EVICTED) return Verdict::ADMIT;
+    auto* entry = Find_(ip);
+    // a full table leaves the IP unlimited
+    if (!entry && !(entry = Insert_(ip, now))) return Verdict::ADMIT;
+
+    if (options_.max_connections &&
+        entry->connections.load(std::memory_order_relaxed) >= options_.max_connections) {
+        return Verdict::CONNECTIONS;
+    }
+    // requests pay when they come, a client out of them cannot connect
+    if (interval_ && entry->tat.load(std::memory_order_relaxed) - now > tolerance_) {
+        return Verdict::RATE;
+    }
+    entry->connections.fetch_add(1, std::memory_order_relaxed);
+    return Verdict::ADMIT;
+}
+
+void ClientLimiter::Disconnect(in_addr_t ip)
+{
+    auto* entry = Find_(ip);
+    if (!entry) return;
+    // connections admitted while the table was full were not counted
+    auto count = entry->connections.load(std::memory_order_relaxed);
+    while (count > 0 &&
+           !entry->connections.compare_exchange_weak(count, count - 1, std::memory_order_relaxed)) { }
+}
+
+auto ClientLimiter::Request(in_addr_t ip, int64_t now) -> Verdict
+{
+    auto* entry = Find_(ip);
+    return !entry || Take_(*entry, now) ? Verdict::ADMIT : Verdict::RATE;
+}
+
+void ClientLimiter::Evict(int64_t now)
+{
+    size_t const slots = mask_ + 1;
+    for (size_t i = 0; i < EVICT_STEP; ++i) {
+        auto& shard = shards_[cursor_ / slots];
+        auto& entry = shard.entries[cursor_ & mask_];
+        cursor_ = (cursor_ + 1) % (SHARDS * slots);
+
+        auto ip = entry.ip.load(std::memory_order_relaxed);
+        if (ip == EMPTY || ip == EVICTED || entry.connections.load(std::memory_order_relaxed) ||
+            now - entry.tat.load(std::memory_order_relaxed) <= idle_) {
+            continue;
+        }
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        if (entry.ip.load(std::memory_order_relaxed) == ip &&
+            !entry.connections.load(std::memory_order_relaxed)) {
+            entry.ip.store(EVICTED, std::memory_order_release);
+            shard.size.fetch_sub(1, std::memory_order_relaxed);
+            Reclaim_(shard, &entry - shard.entries.get());
+        }
+    }
+}
+
+auto ClientLimiter::Size() const -> size_t
+{
+    size_t size = 0;
+    for (auto const& shard : shards_) size += shard.size.load(std::memory_order_relaxed);
+    return size;
+}
+
+auto ClientLimiter::Find_(in_addr_t ip) -> Entry*
+{
+    auto hash = Hash_(ip);
+    auto& shard = shards_[hash >> 58];
+    for (size_t i = hash >> 32, n = 0; n <= mask_; ++i, ++n) {
+        auto& entry = shard.entries[i & mask_];
+        auto found = entry.ip.load(std::memory_order_acquire);
+        if (found == ip) return &entry;
+        if (found == EMPTY) return nullptr;
+    }
+    return nullptr;
+}
+
+auto ClientLimiter::Insert_(in_addr_t ip, int64_t now) -> Entry*
+{
+    auto hash = Hash_(ip);
+    auto& shard = shards_[hash >> 58];
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    if (shard.size.load(std::memory_order_relaxed) >= per_shard_) return nullptr;
+
+    // the first evicted slot on the way is reused, once the IP is known
+    // not to be further on
+    Entry* slot = nullptr;
+    for (size_t i = hash >> 32, n = 0; n <= mask_; ++i, ++n) {
+        auto& entry = shard.entries[i & mask_];
+        auto found = entry.ip.load(std::memory_order_relaxed);
+        if (found == ip) return &entry;
+        if (found == EVICTED && !slot) slot = &entry;
+        if (found == EMPTY) {
+            if (!slot) slot = &entry;
+            break;
+        }
+    }
+    if (!slot) return nullptr;
+
+    slot->connections.store(0, std::memory_order_relaxed);
+    slot->tat.store(now, std::memory_order_relaxed);
+    slot->ip.store(ip, std::memory_order_release);
+    shard.size.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+void ClientLimiter::Reclaim_(Shard& shard, size_t index)
+{
+    // no IP lies past a run of evicted slots ending at an empty one, so
+    // the run can be emptied and probes stop where it starts
+    if (shard.entries[(index + 1) & mask_].ip.load(std::memory_order_relaxed) != EMPTY) return;
+    for (size_t n = 0; n <= mask_; ++n, --index) {
+        auto& entry = shard.entries[index & mask_];
+        if (entry.ip.load(std::memory_order_relaxed) != EVICTED) break;
+        entry.ip.store(EMPTY, std::memory_order_release);
+    }
+}
+
+auto ClientLimiter::Take_(Entry& entry, int64_t now) -> bool
+{
+    if (!interval_) {
+        entry.tat.store(now, std::memory_order_relaxed);
+        return true;
+    }
+    auto tat = entry.tat.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        if (tat - now > tolerance_) return false;
+        next = std::max(tat, now) + interval_;
+    } while (!entry.tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+    return true;
+}
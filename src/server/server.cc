@@ -1,15 +1,62 @@
 #include "server.hh"
 
+#include <csignal>
+
+namespace
+{
+Counter accepted("server_accepted_total", "Connections accepted.");
+Counter refused_connections("server_refused_total", "Connections refused by admission control.",
+                            "reason=\"connections\"");
+Counter refused_queue("server_refused_total", "Connections refused by admission control.",
+                      "reason=\"queue\"");
+Counter refused_memory("server_refused_total", "Connections refused by admission control.",
+                       "reason=\"memory\"");
+Counter limited_rate("server_limited_total", "Connections and requests refused by client limits.",
+                     "reason=\"rate\"");
+Counter limited_connections("server_limited_total", "Connections and requests refused by client limits.",
+                            "reason=\"connections\"");
+Counter early_reads("server_early_reads_total", "Connections whose request was read right at accept.");
+// per shard, so webstat can tell the load of each pool thread
+Counter busy("server_busy_microseconds_total", "Time pool threads spent on connections.");
+} // namespace
+
 WebServer::WebServer(std::string_view src_dir,
                      int port, int trigger_mode, int timeout, bool opt_linger,
-                     Timer::ptr&& timer, ThreadPool::ptr&& thread_pool) :
+                     Timer::ptr&& timer, ThreadPool::ptr&& thread_pool,
+                     SocketOptions const& socket_options,
+                     AdmissionOptions const& admission,
+                     ClientLimitOptions const& client_limit) :
     src_dir_(src_dir),
-    port_(port), timeout_(timeout), linger_(opt_linger), listen_fd_(-1),
+    port_(port), timeout_(timeout), linger_(opt_linger),
+    socket_options_(socket_options), admission_(admission),
+    client_limiter_(client_limit), listen_fd_(-1),
     timer_(std::move(timer)), thread_pool_(std::move(thread_pool)),
-    epoller_(new Epoller(1024)), connections_()
+    epoller_(new Epoller(1024)), connections_(),
+    timer_size_(0),
+    timer_gauge_("server_timers", "Pending connection timeouts.",
+                 [this] { return double(timer_size_.load(std::memory_order_relaxed)); }),
+    queue_gauge_("server_pool_queue", "Tasks waiting for a pool thread.",
+                 [this] { return double(thread_pool_->QueueSize()); }),
+    clients_gauge_("server_limited_clients", "Client IPs tracked by the client limits.",
+                   [this] { return double(client_limiter_.Size()); })
 {
     HttpConnection::user_count = 0;
     HttpConnection::base_ = src_dir_;
+    HttpConnection::cork = socket_options_.cork;
+    // requests pay as they are parsed, pipelined ones too
+    HttpConnection::admit = nullptr;
+    if (client_limiter_.Rated()) {
+        HttpConnection::admit = [this](::in_addr_t ip) {
+            if (client_limiter_.Request(ip, AccessLog::Now()) == ClientLimiter::Verdict::ADMIT) {
+                return true;
+            }
+            limited_rate.Add();
+            return false;
+        };
+        HttpConnection::refusal = client_limiter_.Response();
+    }
+    // a peer closing during writev must fail the write, not kill us
+    ::signal(SIGPIPE, SIG_IGN);
 
     InitEventMode_(trigger_mode);
     if (!InitSocket_()) {
@@ -30,13 +77,17 @@ void WebServer::Start()
 {
     Timer::rep t = -1;
     while (!closed_) {
-        if (timeout_ > 0) t = timer_->NextTick();
+        if (timeout_ > 0) {
+            t = timer_->NextTick();
+            timer_size_.store(timer_->Size(), std::memory_order_relaxed);
+        }
 
         int event_count = epoller_->Wait(t);
         if (event_count < 0) {
             LOG_ERROR("epoll error!");
             continue;
         }
+        if (client_limiter_.Enabled()) client_limiter_.Evict(AccessLog::Now());
         while (event_count--) {
             int fd = epoller_->EventFd(event_count);
             Epoller::events_t events = epoller_->GetEvents(event_count);
@@ -48,8 +99,12 @@ void WebServer::Start()
             assert(connections_.contains(fd));
             auto conn = connections_.at(fd);
 
-            if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            if (events & (EPOLLRDHUP | EPOLLHUP)) {
                 CloseConn_(conn);
+            } else if (events & EPOLLERR) {
+                // zerocopy completions wait on the error queue
+                if (HttpConnection::zerocopy_size) DealError_(conn);
+                else CloseConn_(conn);
             } else if (events & EPOLLIN) {
                 DealRead_(conn);
             } else if (events & EPOLLOUT) {
@@ -76,54 +131,142 @@ void WebServer::InitEventMode_(int trigger_mode)
 void WebServer::AddClient_(int fd, sockaddr_in const& addr)
 {
     auto conn = HttpConnection::ptr(new HttpConnection {fd, addr});
-    auto [it, b] = connections_.emplace(fd, std::move(conn));
+    // a reused fd replaces the closed connection, emplace would drop
+    // the new one and close the fd with it
+    auto [it, b] = connections_.insert_or_assign(fd, std::move(conn));
+    auto const& client = it->second;
+    SetClientOptions_(fd);
+
+    if (b) LOG_INFO("add client {}", fd);
+    else LOG_INFO("re-add client {}", fd);
+
+    // the request often came with the handshake (always with
+    // TCP_DEFER_ACCEPT), reading it now saves waiting for EPOLLIN
+    int r = client->Read();
+    if (r == 0 || (r < 0 && ~r != EAGAIN)) {
+        CloseConn_(client);
+        return;
+    }
 
     if (timeout_ > 0) {
-        timer_->AddEvent(fd, timeout_,
-                         std::bind(&self::CloseConn_, this, it->second));
+        timer_->AddEvent(fd, timeout_, [this, conn = client] {
+            TRACE_PROBE(timer_expire, conn->Fd());
+            CloseConn_(conn);
+        });
+    }
+    client->Handoff();
+    if (r > 0) {
+        early_reads.Add();
+        AddTask_(client, "queue accept", &self::OnAccept_);
+    } else {
+        epoller_->AddEvent(fd, connect_event_ | EPOLLIN);
     }
-    epoller_->AddEvent(fd, connect_event_ | EPOLLIN);
-    SetFdNonBlock(fd);
+}
 
-    if (b) LOG_INFO("add client " + std::to_string(fd));
-    else LOG_INFO("re-add client " + std::to_string(fd));
+void WebServer::SetClientOptions_(int fd)
+{
+    auto set = [fd](int level, int name, int value, char const* what) {
+        if (::setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+            LOG_WARN("{} on {}: {}", what, fd, error_message(errno).value());
+        }
+    };
+    auto const& o = socket_options_;
+    if (o.nodelay) set(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (o.notsent_lowat) set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, o.notsent_lowat, "TCP_NOTSENT_LOWAT");
+    if (o.busy_poll) set(SOL_SOCKET, SO_BUSY_POLL, o.busy_poll, "SO_BUSY_POLL");
 }
 
 void WebServer::DealListen_()
 {
-    ::sockaddr_in addr;
-    ::socklen_t len = sizeof(addr);
-    do {
-        int fd = ::accept(listen_fd_, (::sockaddr*)&addr, &len);
-        if (fd <= 0) return;
-        else if (HttpConnection::user_count >= MAX_FD) {
-            SendError_(fd, "Server Busy!");
-            LOG_WARN("Server Busy!");
+    for (int i = 0; i < ACCEPT_BATCH; ++i) {
+        ::sockaddr_in addr;
+        ::socklen_t len = sizeof(addr);
+        int fd = ::accept4(listen_fd_, (::sockaddr*)&addr, &len,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ECONNABORTED || errno == EINTR) continue;
+            if (errno != EAGAIN) LOG_WARN("accept: {}", error_message(errno).value());
             return;
         }
+        auto now = AccessLog::Now();
+        if (auto verdict = admission_.Admit(HttpConnection::user_count, now);
+            verdict != Admission::Verdict::ADMIT) {
+            SendError_(fd, admission_.Response());
+            ::close(fd);
+            switch (verdict) {
+            case Admission::Verdict::CONNECTIONS: refused_connections.Add(); break;
+            case Admission::Verdict::QUEUE: refused_queue.Add(); break;
+            default: refused_memory.Add(); break;
+            }
+            LOG_WARN("Server Busy!");
+            continue;
+        }
+        if (client_limiter_.Enabled()) {
+            auto verdict = client_limiter_.Connect(addr.sin_addr.s_addr, now);
+            if (verdict != ClientLimiter::Verdict::ADMIT) {
+                SendError_(fd, client_limiter_.Response());
+                ::close(fd);
+                if (verdict == ClientLimiter::Verdict::RATE) limited_rate.Add();
+                else limited_connections.Add();
+                LOG_WARN("Too Many Requests from {}", ::inet_ntoa(addr.sin_addr));
+                continue;
+            }
+        }
+        accepted.Add();
+        TRACE_PROBE(accept, fd);
         AddClient_(fd, addr);
-    } while (listen_event_ & EPOLLET);
+    }
+    // the batch is used up, an edge triggered listener has to be
+    // re-armed to report the connections still queued
+    if (listen_event_ & EPOLLET) epoller_->ChangeEvent(listen_fd_, listen_event_ | EPOLLIN);
 }
 
 void WebServer::DealWrite_(HttpConnection::ptr client)
 {
     ExtentTime_(client);
-    thread_pool_->AddTask(std::bind(&self::OnWrite_, this, client));
-    LOG_INFO("DealWrite " + std::to_string(client->Fd()));
+    AddTask_(client, "queue write", &self::OnWrite_);
+    LOG_INFO("DealWrite {}", client->Fd());
+}
+
+void WebServer::DealError_(HttpConnection::ptr client)
+{
+    AddTask_(client, "queue error", &self::OnError_);
+    LOG_INFO("DealError {}", client->Fd());
 }
 
 void WebServer::DealRead_(HttpConnection::ptr client)
 {
     ExtentTime_(client);
-    thread_pool_->AddTask(std::bind(&self::OnRead_, this, client));
-    LOG_INFO("DealRead " + std::to_string(client->Fd()));
+    AddTask_(client, "queue read", &self::OnRead_);
+    LOG_INFO("DealRead {}", client->Fd());
+}
+
+void WebServer::AddTask_(HttpConnection::ptr const& client, char const* name,
+                         void (self::*task)(HttpConnection::ptr))
+{
+    TRACE_PROBE(pool_enqueue, client->Fd());
+    thread_pool_->AddTask([this, client, name, task, queued = AccessLog::Now()](bool dropped) {
+        // the queue discipline gave up on it, its client most likely too
+        if (dropped) {
+            LOG_INFO("drop {} of {}", name, client->Fd());
+            CloseConn_(client);
+            return;
+        }
+        auto start = AccessLog::Now();
+        TRACE_PROBE(pool_dequeue, client->Fd(), start - queued);
+        admission_.Dequeued(start - queued, start);
+        if (auto* tracer = Tracer::Active()) tracer->Span(name, client->Fd(), 0, queued, start);
+        (this->*task)(client);
+        busy.Add(AccessLog::Now() - start);
+    });
 }
 
 void WebServer::SendError_(int fd, std::string_view message)
 {
-    int r = ::send(fd, message.data(), message.size(), 0);
-    if (r < 0) LOG_WARN("Fail to send error to " + std::to_string(fd));
-    ::close(fd);
+    char sink[4096];
+    ::recv(fd, sink, sizeof(sink), MSG_DONTWAIT);
+    int r = ::send(fd, message.data(), message.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (r < 0) LOG_WARN("Fail to send error to {}", fd);
 }
 
 void WebServer::ExtentTime_(HttpConnection::ptr client)
@@ -136,10 +279,12 @@ void WebServer::CloseConn_(HttpConnection::ptr client)
 {
     assert(client);
     int fd = client->Fd();
-    epoller_->RemoveEvent(fd);
-    client->Close();
+    // closing drops the fd from the epoll set; the caller that lost the
+    // race leaves it alone, it may belong to a new connection by now
+    if (!client->Close()) return;
+    if (client_limiter_.Enabled()) client_limiter_.Disconnect(client->Addr().sin_addr.s_addr);
     // connections_.erase(fd);
-    LOG_INFO("close client " + std::to_string(fd));
+    LOG_INFO("close client {}", fd);
 }
 
 void WebServer::OnRead_(HttpConnection::ptr client)
@@ -148,7 +293,7 @@ void WebServer::OnRead_(HttpConnection::ptr client)
     int r = client->Read();
     if (r < 0 && ~r != EAGAIN) {
         CloseConn_(client);
-        LOG_INFO("on read: " + error_message(~r).value());
+        LOG_INFO("on read: {}", error_message(~r).value());
     }
     OnProcess(client);
 }
@@ -163,6 +308,7 @@ void WebServer::OnWrite_(HttpConnection::ptr client)
             return;
         }
     } else if (r < 0 && ~r == EAGAIN) {
+        client->Handoff();
         epoller_->ChangeEvent(client->Fd(),
                               connect_event_ | EPOLLOUT);
         return;
@@ -170,10 +316,37 @@ void WebServer::OnWrite_(HttpConnection::ptr client)
     CloseConn_(client);
 }
 
+void WebServer::OnError_(HttpConnection::ptr client)
+{
+    assert(client);
+    int r = client->Complete();
+    if (r < 0) {
+        LOG_INFO("on error: {}", error_message(~r).value());
+        CloseConn_(client);
+        return;
+    }
+    // waits for what it waited for before the completions
+    client->Handoff();
+    epoller_->ChangeEvent(client->Fd(),
+                          connect_event_ | (client->ToWriteBytes() ? EPOLLOUT : EPOLLIN));
+}
+
+void WebServer::OnAccept_(HttpConnection::ptr client)
+{
+    assert(client);
+    bool processed = client->Process();
+    client->Handoff();
+    // not in the epoll set yet
+    epoller_->AddEvent(client->Fd(), connect_event_ | (processed ? EPOLLOUT : EPOLLIN));
+}
+
 void WebServer::OnProcess(HttpConnection::ptr client)
 {
     assert(client);
-    if (client->Process()) {
+    bool processed = client->Process();
+    // one shot events, a pool thread may take it once re-armed
+    client->Handoff();
+    if (processed) {
         epoller_->ChangeEvent(client->Fd(), connect_event_ | EPOLLOUT);
     } else {
         epoller_->ChangeEvent(client->Fd(), connect_event_ | EPOLLIN);
@@ -184,7 +357,7 @@ auto WebServer::SetFdNonBlock(int fd) -> int
 {
     assert(fd > 0);
     return ::fcntl(fd, F_SETFL,
-                   ::fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+                   ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
 
 auto WebServer::InitSocket_() -> bool
@@ -202,13 +375,13 @@ auto WebServer::InitSocket_() -> bool
                 ::close(listen_fd);               \
                 listen_fd = -1;                   \
             }                                     \
-            LOG_FATAL(#f " fail: " + em.value()); \
+            LOG_FATAL(#f " fail: {}", em.value()); \
             return false;                         \
         }                                         \
     } while (0)
 
     if (port_ < 1024 || port_ > 65535) {
-        LOG_ERROR("Port: " + std::to_string(port_));
+        LOG_ERROR("Port: {}", port_);
         return false;
     }
 
@@ -231,9 +404,27 @@ auto WebServer::InitSocket_() -> bool
     ERROR_CHECK(::setsockopt, listen_fd, SOL_SOCKET, SO_REUSEADDR,
                 &optval, sizeof(optval));
 
+    auto const& o = socket_options_;
+    if (o.sndbuf) {
+        ERROR_CHECK(::setsockopt, listen_fd, SOL_SOCKET, SO_SNDBUF,
+                    &o.sndbuf, sizeof(o.sndbuf));
+    }
+    if (o.rcvbuf) {
+        ERROR_CHECK(::setsockopt, listen_fd, SOL_SOCKET, SO_RCVBUF,
+                    &o.rcvbuf, sizeof(o.rcvbuf));
+    }
+    if (o.fastopen) {
+        ERROR_CHECK(::setsockopt, listen_fd, IPPROTO_TCP, TCP_FASTOPEN,
+                    &o.fastopen, sizeof(o.fastopen));
+    }
+    if (o.defer_accept) {
+        ERROR_CHECK(::setsockopt, listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                    &o.defer_accept, sizeof(o.defer_accept));
+    }
+
     ERROR_CHECK(::bind, listen_fd, (struct sockaddr*)&addr, sizeof(addr));
 
-    ERROR_CHECK(::listen, listen_fd, 8);
+    ERROR_CHECK(::listen, listen_fd, o.backlog);
 
     r = epoller_->AddEvent(listen_fd, listen_event_ | EPOLLIN);
     if (!r) {
@@ -246,8 +437,7 @@ auto WebServer::InitSocket_() -> bool
 
     listen_fd_ = listen_fd;
 
-    LOG_INFO("listen socket " + std::to_string(listen_fd_) +
-             " in " + std::to_string(port_));
+    LOG_INFO("listen socket {} in {}", listen_fd_, port_);
 
     return true;
 
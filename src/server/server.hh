@@ -1,17 +1,170 @@
 #ifndef __SERVER__H_
 #define __SERVER__H_
 
+#include <array>
+#include <atomic>
 #include <filesystem>
+#include <mutex>
 #include <string>
 
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 
 #include "http/epoll.hh"
 #include "http/http.hh"
 #include "log/log.hh"
+#include "metrics/metrics.hh"
 #include "thread/thread.hh"
 #include "timer/timer.hh"
 
+// TCP options of the listener and of accepted sockets, 0 or false
+// keeps the kernel default
+struct SocketOptions {
+    int backlog = 1024;
+    bool nodelay = false;
+    bool cork = false;     // TCP_CORK around each response
+    int notsent_lowat = 0; // bytes
+    // bytes, set on the listener before listen() so accepted sockets
+    // inherit them and the window scale follows
+    int sndbuf = 0;
+    int rcvbuf = 0;
+    int fastopen = 0;     // queued requests carrying data in the SYN
+    int defer_accept = 0; // seconds to wait for the request before accept
+    int busy_poll = 0;    // microseconds, needs CAP_NET_ADMIN above net.core.busy_read
+};
+
+// Limits on new connections, 0 turns a limit off
+struct AdmissionOptions {
+    int max_connections = 0; // at most Admission::MAX_CONNECTIONS
+    // ms, the pool is overloaded while no task over an interval waited
+    // less than the target (CoDel), i.e. the queue never drained
+    int queue_target = 0;
+    int queue_interval = 100;
+    size_t max_memory = 0; // bytes resident
+    int retry_after = 1;   // seconds
+};
+
+// Decides at accept whether the server takes a connection, the ones
+// turned away get a precomposed 503 from the reactor
+class Admission
+{
+public:
+    enum class Verdict {
+        ADMIT,
+        CONNECTIONS,
+        QUEUE,
+        MEMORY,
+    };
+
+    static constexpr int MAX_CONNECTIONS = 65536;
+
+    explicit Admission(AdmissionOptions const& options);
+
+    // from pool threads, wait is how long a task was queued, in us
+    void Dequeued(int64_t wait, int64_t now);
+
+    // from the reactor only
+    auto Admit(int connections, int64_t now) -> Verdict;
+
+    auto Response() const -> std::string_view { return response_; }
+
+private:
+    auto Resident_() const -> size_t;
+
+    AdmissionOptions options_;
+    int64_t target_, interval_; // us
+    std::string response_;
+
+    // the interval being measured, its smallest wait and whether the
+    // last one ended with a standing queue
+    std::atomic<int64_t> window_start_;
+    std::atomic<int64_t> window_min_;
+    std::atomic<bool> standing_;
+
+    // resident bytes, read once per interval
+    size_t resident_;
+    int64_t resident_at_;
+};
+
+// Per client IP limits, 0 turns a limit off
+struct ClientLimitOptions {
+    double rate = 0; // requests per second
+    uint32_t burst = 1;
+    int max_connections = 0;  // open at once
+    int idle = 60000;         // ms an IP without connections is kept
+    size_t capacity = 1 << 16; // IPs tracked, others are not limited
+    int retry_after = 1;       // seconds
+};
+
+// Limits of each client IP in a sharded open addressing table. The
+// request rate is a GCRA token bucket, one theoretical arrival time per
+// IP; lookups and updates are lock free, only adding and evicting IPs
+// lock their shard. Refused clients get a precomposed 429.
+class ClientLimiter
+{
+public:
+    enum class Verdict {
+        ADMIT,
+        RATE,
+        CONNECTIONS,
+    };
+
+    explicit ClientLimiter(ClientLimitOptions const& options);
+
+    auto Enabled() const -> bool { return interval_ || options_.max_connections; }
+    auto Rated() const -> bool { return interval_; }
+
+    // a new connection, refused while its IP has no requests left;
+    // Disconnect undoes an admitted one
+    auto Connect(in_addr_t ip, int64_t now) -> Verdict;
+    void Disconnect(in_addr_t ip);
+
+    // a request on an open connection
+    auto Request(in_addr_t ip, int64_t now) -> Verdict;
+
+    // drops IPs idle for long enough, a slice of the table per call
+    void Evict(int64_t now);
+
+    // IPs in the table
+    auto Size() const -> size_t;
+
+    auto Response() const -> std::string_view { return response_; }
+
+private:
+    struct Entry {
+        std::atomic<in_addr_t> ip;
+        std::atomic<int32_t> connections;
+        std::atomic<int64_t> tat; // us, the last request when not rated
+    };
+
+    struct alignas(64) Shard {
+        std::unique_ptr<Entry[]> entries;
+        std::mutex mtx;
+        std::atomic<size_t> size = 0; // IPs in the shard
+    };
+
+    static constexpr size_t SHARDS = 64;
+
+    static auto Hash_(in_addr_t ip) -> uint64_t { return ip * 0x9E3779B97F4A7C15ull; }
+
+    auto Find_(in_addr_t ip) -> Entry*;
+    auto Insert_(in_addr_t ip, int64_t now) -> Entry*;
+    auto Take_(Entry& entry, int64_t now) -> bool;
+
+    // empties the evicted slots ending at index if an empty one follows;
+    // the shard is locked
+    void Reclaim_(Shard& shard, size_t index);
+
+    ClientLimitOptions options_;
+    int64_t interval_, tolerance_, idle_; // us
+    std::string response_;
+
+    size_t mask_;      // slots per shard - 1
+    size_t per_shard_; // IPs per shard
+    std::array<Shard, SHARDS> shards_;
+    size_t cursor_; // the next slot Evict looks at, over all shards
+};
+
 class WebServer
 {
 public:
@@ -21,7 +174,10 @@ public:
     WebServer(std::string_view src_dir,
               int port, int trigger_mode,
               int timeout, bool opt_linger,
-              Timer::ptr&& timer, ThreadPool::ptr&& thread_pool);
+              Timer::ptr&& timer, ThreadPool::ptr&& thread_pool,
+              SocketOptions const& socket_options = {},
+              AdmissionOptions const& admission = {},
+              ClientLimitOptions const& client_limit = {});
 
     ~WebServer();
 
@@ -34,12 +190,23 @@ private:
 
     void AddClient_(int fd, sockaddr_in const& addr);
 
+    // the options of accepted sockets, failures are only logged
+    void SetClientOptions_(int fd);
+
     void DealListen_();
 
     void DealWrite_(HttpConnection::ptr client);
 
     void DealRead_(HttpConnection::ptr client);
 
+    void DealError_(HttpConnection::ptr client);
+
+    // runs task in the pool, timing the wait and the run
+    void AddTask_(HttpConnection::ptr const& client, char const* name,
+                  void (self::*task)(HttpConnection::ptr));
+
+    // drains what the peer sent so closing next does not reset the
+    // reply
     void SendError_(int fd, std::string_view message);
 
     void ExtentTime_(HttpConnection::ptr client);
@@ -50,9 +217,16 @@ private:
 
     void OnWrite_(HttpConnection::ptr client);
 
+    void OnError_(HttpConnection::ptr client);
+
+    // the request read at accept, registers the connection
+    void OnAccept_(HttpConnection::ptr client);
+
     void OnProcess(HttpConnection::ptr client);
 
-    static constexpr int MAX_FD = 65536;
+    // accepted per listener wakeup, the loop gets back to the
+    // connections in between
+    static constexpr int ACCEPT_BATCH = 64;
 
     static auto SetFdNonBlock(int fd) -> int;
 
@@ -61,6 +235,9 @@ private:
     int port_;
     int timeout_;
     bool linger_;
+    SocketOptions socket_options_;
+    Admission admission_;
+    ClientLimiter client_limiter_;
 
     int listen_fd_;
     bool closed_;
@@ -72,6 +249,12 @@ private:
     std::unique_ptr<ThreadPool> thread_pool_;
     std::unique_ptr<Epoller> epoller_;
     std::unordered_map<int, HttpConnection::ptr> connections_;
+
+    // read by the metrics composer, declared last to unregister first
+    std::atomic<size_t> timer_size_;
+    GaugeFunc timer_gauge_;
+    GaugeFunc queue_gauge_;
+    GaugeFunc clients_gauge_;
 };
 
 #endif // __SERVER__H_
\ No newline at end of file
@@ -1,4 +1,4 @@
 target("server")
     set_kind("static")
     add_files("*.cc")
-    add_deps("http", "log", "thread", "timer")
\ No newline at end of file
+    add_deps("http", "log", "metrics", "thread", "timer")
\ No newline at end of file
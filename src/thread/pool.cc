@@ -1 +1,103 @@
 #include "thread.hh"
+
+#include <ctime>
+
+#include "metrics/metrics.hh"
+
+namespace
+{
+Counter dropped_total("server_pool_dropped_total", "Tasks dropped while the pool queue was standing.");
+Counter expired_total("server_pool_expired_total", "Tasks dropped past the pool deadline.");
+} // namespace
+
+ThreadPool::ThreadPool(size_t count) :
+    ThreadPool(count, Options()) { }
+
+ThreadPool::ThreadPool(size_t count, Options const& options) :
+    count_(count), options_(options), pool_(new Pool())
+{
+    assert(count);
+    pool_->closed_ = false;
+    pool_->last_empty_ = Now_();
+    while (count--) {
+        std::thread(Work_, pool_, options_).detach();
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    if (pool_) {
+        std::lock_guard<std::mutex> locker(pool_->mtx_);
+        pool_->closed_ = true;
+        pool_->cond_.notify_all();
+    }
+}
+
+auto ThreadPool::Now_() -> int64_t
+{
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void ThreadPool::Work_(Pool::ptr pool, Options options)
+{
+    bool const timed = Timed_(options);
+    Task task;
+    std::vector<Task> dropped;
+    std::unique_lock<std::mutex> locker(pool->mtx_);
+    while (!pool->closed_) {
+        auto& tasks = pool->tasks_;
+        if (tasks.empty()) {
+            if (timed) pool->last_empty_ = Now_();
+            pool->cond_.wait(locker);
+            continue;
+        }
+        bool run = true;
+        if (timed) {
+            run = Pop_(*pool, options, Now_(), task, dropped);
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        locker.unlock();
+        for (auto& d : dropped) d.run(true);
+        dropped.clear();
+        if (run) task.run(false);
+        task.run = nullptr;
+        locker.lock();
+    }
+}
+
+auto ThreadPool::Pop_(Pool& pool, Options const& options, int64_t now,
+                      Task& task, std::vector<Task>& dropped) -> bool
+{
+    auto& tasks = pool.tasks_;
+    int64_t const deadline = int64_t(options.deadline) * 1000;
+    bool const standing = options.discipline == Discipline::ADAPTIVE &&
+                          now - pool.last_empty_ > int64_t(options.interval) * 1000;
+    int64_t const limit = standing ? int64_t(options.target) * 1000 : deadline;
+
+    // the oldest tasks are at the front in both orders
+    while (limit && !tasks.empty() && tasks.front().droppable &&
+           now - tasks.front().queued > limit) {
+        if (deadline && now - tasks.front().queued > deadline) expired_total.Add();
+        else dropped_total.Add();
+        dropped.push_back(std::move(tasks.front()));
+        tasks.pop_front();
+    }
+    if (tasks.empty()) {
+        pool.last_empty_ = now;
+        return false;
+    }
+
+    if (standing) {
+        task = std::move(tasks.back());
+        tasks.pop_back();
+    } else {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+    if (tasks.empty()) pool.last_empty_ = now;
+    return true;
+}
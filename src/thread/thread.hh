@@ -2,8 +2,9 @@
 #define __THREAD__H_
 
 #include <cassert>
+#include <cstdint>
 
-#include <queue>
+#include <algorithm>
 
 #include <memory>
 
@@ -12,68 +13,159 @@
 #include <thread>
 
 #include <functional>
+#include <vector>
 
+// Runs tasks on a fixed set of threads. FIFO takes tasks in order;
+// ADAPTIVE follows CoDel: once the queue has not been empty for an
+// interval it is standing, the newest tasks are taken first (whose
+// clients are still waiting) and tasks older than the target are
+// dropped. Tasks past the deadline are dropped in either mode. Only
+// tasks taking a bool can be dropped, they are then called with true.
 class ThreadPool
 {
+public:
+    typedef ThreadPool self;
+    typedef std::unique_ptr<self> ptr;
+
+    enum class Discipline {
+        FIFO,
+        ADAPTIVE,
+    };
+
+    // ms, 0 for no deadline
+    struct Options {
+        Discipline discipline = Discipline::FIFO;
+        int target = 5;
+        int interval = 100;
+        int deadline = 0;
+    };
+
+private:
+    struct Task {
+        std::function<void(bool)> run;
+        int64_t queued; // us
+        bool droppable;
+    };
+
+    // a growing ring of tasks; a deque allocates a node every few
+    // tasks and a worker frees it, on another thread than the producer
+    class Ring
+    {
+    public:
+        auto empty() const -> bool { return !size_; }
+        auto size() const -> size_t { return size_; }
+
+        auto front() -> Task& { return tasks_[head_]; }
+        auto back() -> Task& { return tasks_[(head_ + size_ - 1) & (tasks_.size() - 1)]; }
+
+        void push_back(Task&& task)
+        {
+            if (size_ == tasks_.size()) grow_();
+            tasks_[(head_ + size_) & (tasks_.size() - 1)] = std::move(task);
+            ++size_;
+        }
+
+        void pop_front()
+        {
+            head_ = (head_ + 1) & (tasks_.size() - 1);
+            --size_;
+        }
+
+        void pop_back() { --size_; }
+
+    private:
+        void grow_()
+        {
+            std::vector<Task> tasks(std::max<size_t>(tasks_.size() * 2, 64));
+            for (size_t i = 0; i < size_; ++i) {
+                tasks[i] = std::move(tasks_[(head_ + i) & (tasks_.size() - 1)]);
+            }
+            tasks_ = std::move(tasks);
+            head_ = 0;
+        }
+
+        std::vector<Task> tasks_; // a power of two
+        size_t head_ = 0;
+        size_t size_ = 0;
+    };
+
     struct Pool {
         typedef Pool self;
         typedef std::shared_ptr<self> ptr;
 
-        std::queue<std::function<void()>> tasks_;
+        Ring tasks_;
         std::mutex mtx_;
         std::condition_variable cond_;
         bool closed_;
+        int64_t last_empty_; // us
     };
 
 public:
-    typedef ThreadPool self;
-    typedef std::unique_ptr<self> ptr;
+    explicit ThreadPool(size_t count = 8);
 
-    explicit ThreadPool(size_t count = 8) :
-        count_(count), pool_(new Pool())
-    {
-        assert(count);
-        while (count--) {
-            std::thread([pool = pool_] {
-                std::unique_lock<std::mutex> locker(pool->mtx_);
-                while (!pool->closed_) {
-                    if (!pool->tasks_.empty()) {
-                        auto task {std::move(pool->tasks_.front())};
-                        pool->tasks_.pop();
-                        locker.unlock();
-                        task();
-                        locker.lock();
-                    } else pool->cond_.wait(locker);
-                }
-            }).detach();
-        }
-    }
+    ThreadPool(size_t count, Options const& options);
+
+    ~ThreadPool();
 
-    ~ThreadPool()
+    template <typename F>
+        requires requires(F task) { task(); }
+    void AddTask(F&& task)
     {
-        if (pool_) {
-            std::lock_guard<std::mutex> locker(pool_->mtx_);
-            pool_->closed_ = true;
-            pool_->cond_.notify_all();
-        }
+        Push_({[task = std::forward<F>(task)](bool dropped) mutable {
+                   if (!dropped) task();
+               },
+               Stamp_(), false});
     }
 
+    // task(false) runs it, task(true) tells it that it was dropped
     template <typename F>
-        requires requires(F task) { task(); }
+        requires requires(F task) { task(true); }
     void AddTask(F&& task)
+    {
+        Push_({std::forward<F>(task), Stamp_(), true});
+    }
+
+    auto Count() const { return count_; }
+
+    auto GetOptions() const -> Options const& { return options_; }
+
+    // tasks waiting for a thread
+    auto QueueSize() const -> size_t
+    {
+        std::lock_guard<std::mutex> locker(pool_->mtx_);
+        return pool_->tasks_.size();
+    }
+
+private:
+    static auto Now_() -> int64_t;
+
+    // plain FIFO never looks at the time
+    static auto Timed_(Options const& options) -> bool
+    {
+        return options.discipline != Discipline::FIFO || options.deadline;
+    }
+
+    auto Stamp_() const -> int64_t { return Timed_(options_) ? Now_() : 0; }
+
+    void Push_(Task&& task)
     {
         {
             std::lock_guard<std::mutex> locker(pool_->mtx_);
-            pool_->tasks_.emplace(std::forward<F>(task));
+            pool_->tasks_.push_back(std::move(task));
         }
         pool_->cond_.notify_one();
     }
 
-    auto Count() const { return count_; }
+    static void Work_(Pool::ptr pool, Options options);
+
+    // moves the next task to run into task, false when all were
+    // dropped into dropped
+    static auto Pop_(Pool& pool, Options const& options, int64_t now,
+                     Task& task, std::vector<Task>& dropped) -> bool;
 
-private:
     size_t count_;
+    Options options_;
     Pool::ptr pool_;
 };
 
-#endif // __THREAD__H_
\ No newline at end of file
+#endif // __THREAD__H_
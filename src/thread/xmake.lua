@@ -1,4 +1,5 @@
 target("thread")
     set_kind("static")
     add_files("*.cc")
+    add_deps("metrics")
     add_syslinks("pthread")
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "trace.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <iterator>
+
+#include <unistd.h>
+
+struct Tracer::Slot {
+    // odd while written
+    std::atomic<uint64_t> seq;
+    char const* name;
+    int32_t lane;
+    int32_t code;
+    uint64_t request;
+    int64_t start;
+    int64_t end;
+};
+
+auto Tracer::Install(size_t size) -> ptr
+{
+    // leaked like the log recorder, spans may be recorded during
+    // static destruction
+    static auto* tracer = new ptr(new Tracer(size));
+    active_.store(tracer->get(), std::memory_order_release);
+    return *tracer;
+}
+
+Tracer::Tracer(size_t size) :
+    size_(std::bit_ceil(std::max(size, size_t(16)))),
+    head_(0), slots_(new Slot[size_]()) { }
+
+Tracer::~Tracer()
+{
+    auto* self = this;
+    active_.compare_exchange_strong(self, nullptr);
+}
+
+void Tracer::Span(char const* name, int lane, uint64_t request,
+                  int64_t start, int64_t end, int code)
+{
+    auto index = head_.fetch_add(1, std::memory_order_relaxed);
+    auto& slot = slots_[index & (size_ - 1)];
+
+    // only a writer a whole ring behind can share the slot, the ring
+    // is sized far above the number of threads
+    slot.seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name = name;
+    slot.lane = lane;
+    slot.code = code;
+    slot.request = request;
+    slot.start = start;
+    slot.end = end;
+    slot.seq.fetch_add(1, std::memory_order_release);
+}
+
+void Tracer::Export(std::string& out) const
+{
+    auto out_it = std::back_inserter(out);
+    auto const pid = ::getpid();
+
+    out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (uint64_t i = head > size_ ? head - size_ : 0; i < head; ++i) {
+        auto const& from = slots_[i & (size_ - 1)];
+        auto seq = from.seq.load(std::memory_order_acquire);
+        if (seq & 1) continue;
+        Slot slot;
+        std::memcpy((void*)&slot, (void const*)&from, sizeof(slot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (from.seq.load(std::memory_order_relaxed) != seq || !slot.name) continue;
+
+        if (!first) out.push_back(',');
+        first = false;
+        std::format_to(out_it,
+                       "\n{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{},\"dur\":{},"
+                       "\"pid\":{},\"tid\":{},\"args\":{{\"request\":{}",
+                       slot.name, slot.start, std::max(slot.end - slot.start, int64_t(0)),
+                       pid, slot.lane, slot.request);
+        if (slot.code) std::format_to(out_it, ",\"code\":{}", slot.code);
+        out.append("}}");
+    }
+    out.append("\n]}\n");
+}
@@ -0,0 +1,69 @@
+#ifndef __TRACE__H_
+#define __TRACE__H_
+
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Static tracepoints of the "webserver" provider, e.g.
+//     TRACE_PROBE(accept, fd);
+// With <sys/sdt.h> (systemtap-sdt-dev) they are USDT probes, a NOP in
+// the code plus an ELF note that bpftrace, perf or SystemTap attach
+// to; otherwise they compile to nothing. There are no semaphores, so
+// the arguments are evaluated whether or not anything is attached:
+// pass values at hand, nothing that takes work to compute.
+#if __has_include(<sys/sdt.h>) && !defined(TRACE_NO_SDT)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, ...) STAP_PROBEV(webserver, name, ##__VA_ARGS__)
+#else
+#define TRACE_PROBE(name, ...) ((void)0)
+#endif
+
+// Spans of the stages of each request kept in one ring, exported in
+// the Chrome trace event format (chrome://tracing, Perfetto). Each
+// connection gets a lane of its own. Recording is a fetch_add and a
+// few stores into a slot guarded by a sequence number.
+class Tracer
+{
+public:
+    typedef Tracer self;
+    typedef std::shared_ptr<self> ptr;
+
+    // one per process, the first call sizes the ring (spans, rounded
+    // up to a power of 2)
+    static auto Install(size_t size) -> ptr;
+
+    // null until installed
+    static auto Active() -> Tracer*
+    {
+        return active_.load(std::memory_order_acquire);
+    }
+
+    ~Tracer();
+
+    // name must outlive the tracer, usually a literal; times are
+    // CLOCK_MONOTONIC microseconds
+    void Span(char const* name, int lane, uint64_t request,
+              int64_t start, int64_t end, int code = 0);
+
+    // the spans still in the ring, oldest first, as a JSON document
+    void Export(std::string& out) const;
+
+    static constexpr std::string_view content_type = "application/json";
+
+private:
+    struct Slot;
+
+    Tracer(size_t size);
+
+    static inline std::atomic<Tracer*> active_;
+
+    size_t size_;
+    std::atomic<uint64_t> head_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+#endif // __TRACE__H_
@@ -0,0 +1,3 @@
+target("trace")
+    set_kind("static")
+    add_files("*.cc")
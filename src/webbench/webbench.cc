@@ -0,0 +1,511 @@
+// HTTP/1.1 load generator for the server:
+//     webbench [-H host] [-p port] [-c connections] [-t threads] [-d seconds]
+//              [-P depth] [-K] [-r rate] [-s scenario | -u path] [-j file]
+// Every thread drives its share of the connections through one epoll
+// loop. Closed loop (the default) keeps depth requests in flight per
+// connection; with -r requests are due at a constant total rate and
+// their latency counts from when they were due, not when a connection
+// was free to send them, so a stalled server is not under-reported
+// (coordinated omission). A scenario file lists "weight path" lines,
+// bench/scenarios/page.txt is the page load of resources/index.html.
+
+#include "metrics/metrics.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+auto Now() -> int64_t
+{
+    ::timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 10050;
+    size_t connections = 64;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    double seconds = 10;
+    size_t depth = 1;
+    bool keep_alive = true;
+    double rate = 0; // requests per second, 0 for closed loop
+    std::string scenario;
+    std::string path = "/";
+    std::string json;
+};
+
+// requests composed once, picked by weight
+struct Mix {
+    std::vector<std::string> requests;
+    std::vector<std::string> paths;
+    std::discrete_distribution<size_t> pick;
+};
+
+struct Stats {
+    uint64_t responses = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0; // connect, read and write failures
+    uint64_t unsent = 0; // due in open loop but never sent
+    uint64_t max = 0;
+    std::array<uint64_t, 6> codes {}; // 1xx..5xx, other
+};
+
+Histogram latency("webbench_latency_seconds", "Request latency.", 1e-6);
+
+class Worker
+{
+    struct Connection {
+        int fd = -1;
+        uint64_t generation = 0; // of the socket, bumped on reconnect
+        bool connected = false;
+        std::string out;
+        size_t out_offset = 0;
+        std::deque<int64_t> started; // per request in flight
+        // response being read
+        std::string head;
+        size_t body_left = 0;
+        bool in_body = false;
+        bool closing = false;
+    };
+
+public:
+    Worker(Options const& options, Mix const& mix, ::sockaddr_in const& addr,
+           size_t connections, double rate, uint32_t seed) :
+        options_(options), mix_(mix), addr_(addr), conns_(connections),
+        interval_(rate > 0 ? 1e6 / rate : 0), engine_(seed),
+        pick_(mix.pick), epfd_(::epoll_create1(EPOLL_CLOEXEC)) { }
+
+    ~Worker()
+    {
+        for (auto& conn : conns_) {
+            if (conn.fd >= 0) ::close(conn.fd);
+        }
+        ::close(epfd_);
+    }
+
+    void Run(int64_t start, int64_t end)
+    {
+        for (size_t i = 0; i < conns_.size(); ++i) Connect_(i);
+
+        double due = start;
+        ::epoll_event events[256];
+        while (true) {
+            int64_t now = Now();
+            if (now >= end) break;
+
+            if (interval_) {
+                for (; due <= now; due += interval_) backlog_.push_back(int64_t(due));
+                Dispatch_();
+            }
+
+            int timeout = int((end - now) / 1000) + 1;
+            if (interval_) timeout = std::clamp(int((due - now) / 1000), 0, timeout);
+            int n = ::epoll_wait(epfd_, events, 256, timeout);
+            for (int i = 0; i < n; ++i) {
+                size_t index = events[i].data.u64;
+                auto& conn = conns_[index];
+                if (!conn.connected) {
+                    int error = 0;
+                    ::socklen_t len = sizeof(error);
+                    ::getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                    if (error || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                        Fail_(index);
+                        continue;
+                    }
+                    if (!(events[i].events & EPOLLOUT)) continue;
+                    conn.connected = true;
+                    if (!interval_) Fill_(index);
+                    else Dispatch_();
+                }
+                if (events[i].events & EPOLLIN) Read_(index);
+                if (conn.fd >= 0 && (events[i].events & EPOLLOUT)) Write_(index);
+            }
+        }
+        stats_.unsent += backlog_.size();
+    }
+
+    auto const& GetStats() const { return stats_; }
+
+private:
+    void Connect_(size_t index)
+    {
+        auto& conn = conns_[index];
+        auto generation = conn.generation + 1;
+        conn = Connection();
+        conn.generation = generation;
+        conn.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        ::setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (::connect(conn.fd, (::sockaddr const*)&addr_, sizeof(addr_)) < 0 &&
+            errno != EINPROGRESS) {
+            ++stats_.errors;
+            ::close(conn.fd);
+            conn.fd = -1;
+            return;
+        }
+        ::epoll_event event {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        event.data.u64 = index;
+        ::epoll_ctl(epfd_, EPOLL_CTL_ADD, conn.fd, &event);
+    }
+
+    // a broken connection drops what it had in flight and reconnects
+    void Fail_(size_t index)
+    {
+        ++stats_.errors;
+        Reconnect_(index);
+    }
+
+    void Reconnect_(size_t index)
+    {
+        auto& conn = conns_[index];
+        // open loop requests in flight are due again
+        if (interval_) backlog_.insert(backlog_.begin(), conn.started.begin(), conn.started.end());
+        ::close(conn.fd);
+        conn.fd = -1;
+        Connect_(index);
+    }
+
+    auto Limit_() const -> size_t { return options_.keep_alive ? options_.depth : 1; }
+
+    void Send_(size_t index, int64_t started)
+    {
+        auto& conn = conns_[index];
+        conn.out.append(mix_.requests[pick_(engine_)]);
+        conn.started.push_back(started);
+        Write_(index);
+    }
+
+    // closed loop: the connection keeps depth requests in flight
+    void Fill_(size_t index)
+    {
+        auto& conn = conns_[index];
+        while (conn.fd >= 0 && conn.connected && !conn.closing && conn.started.size() < Limit_()) {
+            Send_(index, Now());
+        }
+    }
+
+    // open loop: due requests go to connections with room
+    void Dispatch_()
+    {
+        for (size_t i = 0; i < conns_.size() && !backlog_.empty(); ++i) {
+            auto& conn = conns_[i];
+            while (!backlog_.empty() && conn.fd >= 0 && conn.connected && !conn.closing &&
+                   conn.started.size() < Limit_()) {
+                Send_(i, backlog_.front());
+                backlog_.pop_front();
+            }
+        }
+    }
+
+    void Write_(size_t index)
+    {
+        auto& conn = conns_[index];
+        while (conn.connected && conn.out_offset < conn.out.size()) {
+            ssize_t n = ::send(conn.fd, conn.out.data() + conn.out_offset,
+                               conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN) Fail_(index);
+                return;
+            }
+            conn.out_offset += n;
+        }
+        if (conn.out_offset == conn.out.size()) {
+            conn.out.clear();
+            conn.out_offset = 0;
+        }
+    }
+
+    void Read_(size_t index)
+    {
+        auto& conn = conns_[index];
+        auto const generation = conn.generation;
+        char buffer[64 << 10];
+        while (conn.fd >= 0 && conn.generation == generation) {
+            ssize_t n = ::recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (n < 0) {
+                if (errno != EAGAIN) Fail_(index);
+                return;
+            }
+            if (n == 0) {
+                // closed by the server: expected after Connection: close
+                if (!conn.started.empty()) ++stats_.errors;
+                Reconnect_(index);
+                return;
+            }
+            stats_.bytes += n;
+            if (!Consume_(index, std::string_view(buffer, n))) {
+                if (conn.generation == generation) Fail_(index);
+                return;
+            }
+        }
+    }
+
+    // parses the responses in data, false on garbage or when the
+    // connection was replaced meanwhile
+    auto Consume_(size_t index, std::string_view data) -> bool
+    {
+        auto& conn = conns_[index];
+        auto const generation = conn.generation;
+        while (!data.empty()) {
+            if (conn.in_body) {
+                size_t n = std::min(conn.body_left, data.size());
+                conn.body_left -= n;
+                data.remove_prefix(n);
+                if (!conn.body_left) {
+                    conn.in_body = false;
+                    Complete_(index);
+                    if (conn.generation != generation) return false;
+                }
+                continue;
+            }
+
+            size_t const old = conn.head.size();
+            conn.head.append(data);
+            auto end = conn.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if (end == std::string::npos) {
+                if (conn.head.size() > (64 << 10)) return false;
+                return true;
+            }
+            data.remove_prefix(end + 4 - old);
+            conn.head.resize(end + 2);
+
+            if (conn.head.compare(0, 5, "HTTP/") || conn.started.empty()) return false;
+            auto space = conn.head.find(' ');
+            int code = space != std::string::npos ? std::atoi(conn.head.c_str() + space + 1) : 0;
+            ++stats_.codes[code >= 100 && code < 600 ? code / 100 - 1 : 5];
+
+            conn.body_left = 0;
+            conn.closing = !options_.keep_alive;
+            for (size_t pos = conn.head.find("\r\n"); pos != std::string::npos;) {
+                size_t next = conn.head.find("\r\n", pos + 2);
+                if (next == std::string::npos) break;
+                std::string_view line(conn.head.data() + pos + 2, next - pos - 2);
+                auto colon = line.find(':');
+                if (colon != std::string_view::npos) {
+                    auto key = line.substr(0, colon);
+                    auto value = line.substr(colon + 1);
+                    while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+                    if (::strncasecmp(key.data(), "content-length", key.size()) == 0 &&
+                        key.size() == 14) {
+                        conn.body_left = std::strtoull(std::string(value).c_str(), nullptr, 10);
+                    } else if (key.size() == 10 && ::strncasecmp(key.data(), "connection", 10) == 0 &&
+                               value.size() == 5 && ::strncasecmp(value.data(), "close", 5) == 0) {
+                        conn.closing = true;
+                    }
+                }
+                pos = next;
+            }
+            conn.head.clear();
+            if (conn.body_left) conn.in_body = true;
+            else {
+                Complete_(index);
+                if (conn.generation != generation) return false;
+            }
+        }
+        return true;
+    }
+
+    void Complete_(size_t index)
+    {
+        auto& conn = conns_[index];
+        uint64_t us = std::max(Now() - conn.started.front(), int64_t(0));
+        conn.started.pop_front();
+        latency.Record(us);
+        stats_.max = std::max(stats_.max, us);
+        ++stats_.responses;
+
+        if (conn.closing) {
+            if (conn.started.empty()) {
+                conn.closing = false;
+                Reconnect_(index);
+            }
+            return;
+        }
+        if (!interval_) Fill_(index);
+        else Dispatch_();
+    }
+
+    Options const& options_;
+    Mix const& mix_;
+    ::sockaddr_in addr_;
+    std::vector<Connection> conns_;
+    double interval_; // us between due requests, 0 for closed loop
+    std::minstd_rand engine_;
+    std::discrete_distribution<size_t> pick_;
+    int epfd_;
+    std::deque<int64_t> backlog_;
+    Stats stats_;
+};
+
+auto LoadMix(Options const& options, Mix& mix) -> bool
+{
+    std::vector<double> weights;
+    auto add = [&](double weight, std::string_view path) {
+        mix.paths.emplace_back(path);
+        mix.requests.push_back(std::format("GET {} HTTP/1.1\r\nHost: {}:{}\r\n"
+                                           "User-Agent: webbench\r\nConnection: {}\r\n\r\n",
+                                           path, options.host, options.port,
+                                           options.keep_alive ? "keep-alive" : "close"));
+        weights.push_back(weight);
+    };
+
+    if (options.scenario.empty()) add(1, options.path);
+    else {
+        std::ifstream file(options.scenario);
+        if (!file) {
+            std::cerr << "webbench: cannot open " << options.scenario << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (auto hash = line.find('#'); hash != std::string::npos) line.resize(hash);
+            std::istringstream in(line);
+            double weight;
+            std::string path;
+            if (!(in >> weight)) continue;
+            if (!(in >> path) || weight <= 0 || path.front() != '/') {
+                std::cerr << "webbench: bad scenario line: " << line << std::endl;
+                return false;
+            }
+            add(weight, path);
+        }
+        if (mix.requests.empty()) {
+            std::cerr << "webbench: empty scenario " << options.scenario << std::endl;
+            return false;
+        }
+    }
+    mix.pick = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    return true;
+}
+
+void Usage(char const* name)
+{
+    std::cerr << "usage: " << name
+              << " [-H host] [-p port] [-c connections] [-t threads] [-d seconds]\n"
+                 "       [-P depth] [-K] [-r rate] [-s scenario | -u path] [-j file]"
+              << std::endl;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "H:p:c:t:d:P:Kr:s:u:j:")) != -1) {
+        switch (opt) {
+        case 'H': options.host = optarg; break;
+        case 'p': options.port = std::atoi(optarg); break;
+        case 'c': options.connections = std::max(std::atol(optarg), 1l); break;
+        case 't': options.threads = std::max(std::atol(optarg), 1l); break;
+        case 'd': options.seconds = std::atof(optarg); break;
+        case 'P': options.depth = std::max(std::atol(optarg), 1l); break;
+        case 'K': options.keep_alive = false; break;
+        case 'r': options.rate = std::atof(optarg); break;
+        case 's': options.scenario = optarg; break;
+        case 'u': options.path = optarg; break;
+        case 'j': options.json = optarg; break;
+        default: Usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc) {
+        Usage(argv[0]);
+        return 2;
+    }
+    options.threads = std::min(options.threads, options.connections);
+
+    ::sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (::inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "webbench: bad address " << options.host << std::endl;
+        return 2;
+    }
+
+    Mix mix;
+    if (!LoadMix(options, mix)) return 2;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < options.threads; ++i) {
+        size_t connections = options.connections / options.threads +
+                             (i < options.connections % options.threads);
+        double rate = options.rate * connections / options.connections;
+        workers.emplace_back(new Worker(options, mix, addr, connections, rate, 12345 + i));
+    }
+
+    int64_t const start = Now();
+    int64_t const end = start + int64_t(options.seconds * 1e6);
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker, start, end] { worker->Run(start, end); });
+    }
+    for (auto& thread : threads) thread.join();
+    double const elapsed = (Now() - start) / 1e6;
+
+    Stats total;
+    for (auto& worker : workers) {
+        auto const& stats = worker->GetStats();
+        total.responses += stats.responses;
+        total.bytes += stats.bytes;
+        total.errors += stats.errors;
+        total.unsent += stats.unsent;
+        total.max = std::max(total.max, stats.max);
+        for (size_t i = 0; i < total.codes.size(); ++i) total.codes[i] += stats.codes[i];
+    }
+
+    auto const counts = latency.Counts();
+    auto ms = [&](double q) { return Histogram::Percentile(counts, q) / 1000.0; };
+    double const rps = total.responses / elapsed;
+
+    std::printf("%zu threads, %zu connections, depth %zu, %s, %s\n", options.threads,
+                options.connections, options.keep_alive ? options.depth : 1,
+                options.keep_alive ? "keep-alive" : "close",
+                options.rate > 0 ? std::format("open loop at {} req/s", options.rate).c_str()
+                                 : "closed loop");
+    std::printf("  %llu responses in %.2f s, %.1f req/s, %.2f MB/s\n",
+                (unsigned long long)total.responses, elapsed, rps, total.bytes / elapsed / 1e6);
+    std::printf("  2xx %llu  3xx %llu  4xx %llu  5xx %llu  other %llu  errors %llu  unsent %llu\n",
+                (unsigned long long)total.codes[1], (unsigned long long)total.codes[2],
+                (unsigned long long)total.codes[3], (unsigned long long)total.codes[4],
+                (unsigned long long)(total.codes[0] + total.codes[5]),
+                (unsigned long long)total.errors, (unsigned long long)total.unsent);
+    std::printf("  latency ms  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+                ms(0.5), ms(0.9), ms(0.99), ms(0.999), total.max / 1000.0);
+
+    if (!options.json.empty()) {
+        auto out = std::format(
+            "{{\"threads\": {}, \"connections\": {}, \"depth\": {}, \"keep_alive\": {}, "
+            "\"rate\": {}, \"seconds\": {:.3f}, \"responses\": {}, \"requests_per_second\": {:.1f}, "
+            "\"bytes\": {}, \"errors\": {}, \"unsent\": {}, \"non_2xx\": {}, "
+            "\"latency_ms\": {{\"p50\": {:.3f}, \"p90\": {:.3f}, \"p99\": {:.3f}, "
+            "\"p999\": {:.3f}, \"max\": {:.3f}}}}}\n",
+            options.threads, options.connections, options.depth, options.keep_alive,
+            options.rate, elapsed, total.responses, rps, total.bytes, total.errors, total.unsent,
+            total.responses - total.codes[1], ms(0.5), ms(0.9), ms(0.99), ms(0.999),
+            total.max / 1000.0);
+        std::ofstream file(options.json);
+        if (!(file << out)) {
+            std::cerr << "webbench: cannot write " << options.json << std::endl;
+            return 1;
+        }
+    }
+    return total.responses ? 0 : 1;
+}
@@ -0,0 +1,4 @@
+target("webbench")
+    set_kind("binary")
+    add_files("*.cc")
+    add_deps("metrics")
@@ -0,0 +1,190 @@
+// Live view of the metrics a server publishes into shared memory:
+//     webstat [-n name] [-i interval_ms] [-c count] [-t counter]
+// Counters show their rate, histograms the percentiles of the last
+// interval and the per thread shards of the -t counter (busy time in
+// microseconds) the load of each thread. Reading the segment never
+// involves the server, so it works when it is too busy to answer.
+
+#include "metrics/segment.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr std::string_view default_name = "/web-server";
+constexpr std::string_view default_load = "server_busy_microseconds_total";
+
+// a consistent copy of the segment, false when the writer kept it busy
+auto Read(MetricsSegment const* segment, MetricsSegment& copy) -> bool
+{
+    for (int tries = 0; tries < 100; ++tries) {
+        auto seq = segment->seq.load(std::memory_order_acquire);
+        if (!(seq & 1)) {
+            std::memcpy((void*)&copy, (void const*)segment, sizeof(copy));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment->seq.load(std::memory_order_relaxed) == seq) return true;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return false;
+}
+
+auto Key(MetricsSegmentEntry const& entry) -> std::string
+{
+    std::string key(entry.name);
+    if (entry.labels[0]) key.append("{").append(entry.labels).append("}");
+    return key;
+}
+
+void Show(MetricsSegment const& now, MetricsSegment const* last, std::string_view load)
+{
+    std::string out;
+    auto put = [&]<typename... Args>(std::format_string<Args...> fmt, Args&&... args) {
+        std::format_to(std::back_inserter(out), fmt, std::forward<Args>(args)...);
+    };
+
+    // entries are matched by name, metrics come and go between reads
+    std::map<std::string, MetricsSegmentEntry const*> before;
+    if (last) {
+        for (uint32_t i = 0; i < last->entry_count; ++i) before[Key(last->entries[i])] = &last->entries[i];
+    }
+    auto previous = [&](MetricsSegmentEntry const& entry) -> MetricsSegmentEntry const* {
+        auto it = before.find(Key(entry));
+        return it != before.end() && it->second->type == entry.type ? it->second : nullptr;
+    };
+    double seconds = last && now.time > last->time ? (now.time - last->time) / 1000.0 : 0;
+
+    bool alive = ::kill(now.pid, 0) == 0 || errno == EPERM;
+    put("pid {}{}  snapshot every {} ms\n\n", now.pid, alive ? "" : " (exited)", now.interval);
+
+    put("{:<56} {:>14} {:>12}\n", "COUNTER", "VALUE", "RATE/s");
+    for (uint32_t i = 0; i < now.entry_count; ++i) {
+        auto const& entry = now.entries[i];
+        if (entry.type != uint32_t(Metric::Type::COUNTER)) continue;
+        auto const* prev = previous(entry);
+        if (prev && seconds) put("{:<56} {:>14} {:>12.1f}\n", Key(entry), entry.value, (entry.value - prev->value) / seconds);
+        else put("{:<56} {:>14} {:>12}\n", Key(entry), entry.value, "-");
+    }
+
+    put("\n{:<56} {:>14}\n", "GAUGE", "VALUE");
+    for (uint32_t i = 0; i < now.entry_count; ++i) {
+        auto const& entry = now.entries[i];
+        if (entry.type != uint32_t(Metric::Type::GAUGE)) continue;
+        put("{:<56} {:>14}\n", Key(entry), entry.value);
+    }
+
+    // percentiles of the samples recorded during the last interval
+    put("\n{:<40} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+        "HISTOGRAM", "RATE/s", "p50", "p90", "p99", "p99.9", "MAX");
+    for (uint32_t i = 0; i < now.entry_count; ++i) {
+        auto const& entry = now.entries[i];
+        if (entry.type != uint32_t(Metric::Type::HISTOGRAM) || entry.histogram < 0) continue;
+        auto counts = now.histograms[entry.histogram].counts;
+        auto const* prev = previous(entry);
+        if (prev && prev->histogram >= 0) {
+            auto const& old = last->histograms[prev->histogram].counts;
+            for (size_t b = 0; b < counts.size(); ++b) counts[b] -= std::min(counts[b], old[b]);
+        }
+        uint64_t total = 0;
+        size_t top = 0;
+        for (size_t b = 0; b < counts.size(); ++b) {
+            total += counts[b];
+            if (counts[b]) top = b;
+        }
+        put("{:<40} {:>10.1f}", Key(entry), seconds ? total / seconds : 0.0);
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            put(" {:>10.4g}", Histogram::Percentile(counts, q) * entry.scale);
+        }
+        put(" {:>10.4g}\n", total ? Histogram::Lower(top + 1) * entry.scale : 0.0);
+    }
+
+    // busy microseconds per shard over the interval
+    put("\n{:<8} {:>8}   ({})\n", "THREAD", "LOAD", load);
+    for (uint32_t i = 0; i < now.entry_count; ++i) {
+        auto const& entry = now.entries[i];
+        if (entry.type != uint32_t(Metric::Type::COUNTER) || Key(entry) != load) continue;
+        auto const* prev = previous(entry);
+        for (size_t s = 0; s < MetricShard::COUNT; ++s) {
+            if (!entry.shards[s]) continue;
+            if (prev && seconds) {
+                double busy = (entry.shards[s] - prev->shards[s]) / (seconds * 1e6);
+                put("{:<8} {:>7.1f}%\n", s, busy * 100);
+            } else put("{:<8} {:>8}\n", s, "-");
+        }
+    }
+
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    std::fflush(stdout);
+}
+
+void Usage(char const* name)
+{
+    std::cerr << "usage: " << name << " [-n name] [-i interval_ms] [-c count] [-t counter]" << std::endl;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string name(default_name);
+    std::string load(default_load);
+    int64_t interval = 1000;
+    int64_t count = -1;
+
+    int opt;
+    while ((opt = ::getopt(argc, argv, "n:i:c:t:")) != -1) {
+        switch (opt) {
+        case 'n': name = optarg; break;
+        case 'i': interval = std::max(std::atoll(optarg), 10ll); break;
+        case 'c': count = std::atoll(optarg); break;
+        case 't': load = optarg; break;
+        default: Usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc) {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "webstat: cannot open " << name << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    void* p = ::mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "webstat: cannot map " << name << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    auto const* segment = static_cast<MetricsSegment const*>(p);
+    if (std::memcmp(segment->magic, MetricsSegment::MAGIC, sizeof(MetricsSegment::MAGIC))) {
+        std::cerr << "webstat: " << name << " is not a metrics segment" << std::endl;
+        return 1;
+    }
+
+    bool const tty = ::isatty(STDOUT_FILENO);
+    auto now = std::make_unique<MetricsSegment>();
+    auto last = std::make_unique<MetricsSegment>();
+    bool have_last = false;
+    for (int64_t i = 0; count < 0 || i < count; ++i) {
+        if (i) std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        if (!Read(segment, *now)) continue;
+        if (tty) std::fputs("\033[H\033[2J", stdout);
+        else if (i) std::fputs("\n", stdout);
+        Show(*now, have_last ? last.get() : nullptr, load);
+        std::swap(now, last);
+        have_last = true;
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+target("webstat")
+    set_kind("binary")
+    add_files("*.cc")
+    add_deps("metrics")
@@ -0,0 +1,99 @@
+#include "http/http.hh"
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include <sys/socket.h>
+
+// the replacements below pair operator new with free on purpose
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+// every global operator new is counted, keep-alive requests served
+// after a warm up must not make one
+static std::atomic<size_t> allocations;
+
+auto operator new(size_t size) -> void*
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+auto operator new(size_t size, std::align_val_t align) -> void*
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::aligned_alloc(size_t(align), (size + size_t(align) - 1) & ~(size_t(align) - 1)))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+// one request through the connection, the response drained by the peer
+static void Serve(HttpConnection& conn, int peer, std::string_view request)
+{
+    if (::send(peer, request.data(), request.size(), 0) != ssize_t(request.size())) std::abort();
+    conn.Read();
+    if (!conn.Process()) std::abort();
+    static char sink[1 << 16];
+    while (conn.ToWriteBytes()) {
+        conn.Write();
+        while (::recv(peer, sink, sizeof(sink), MSG_DONTWAIT) > 0) { }
+    }
+    while (::recv(peer, sink, sizeof(sink), MSG_DONTWAIT) > 0) { }
+}
+
+int main()
+{
+    constexpr std::string_view request {
+        "GET /test.yaml HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n"
+        "User-Agent: alloc_test\r\n"
+        "Accept: */*\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"};
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) std::abort();
+    HttpConnection::et = false;
+    HttpConnection::base_ = ".";
+
+    HttpConnection conn(fds[0], {});
+    for (int i = 0; i < 100; ++i) Serve(conn, fds[1], request);
+
+    size_t before = allocations.load();
+    for (int i = 0; i < 1000; ++i) Serve(conn, fds[1], request);
+    size_t count = allocations.load() - before;
+
+    std::cout << "response " << int(conn.Code()) << ", "
+              << count << " allocations in 1000 requests\n";
+    assert(conn.Code() == HttpCode::OK);
+    assert(count == 0);
+
+    // served from the file cache, the body is not read again either
+    HttpResponse::file_cache = std::make_shared<FileCache>(1 << 20, 1 << 20);
+    for (int i = 0; i < 100; ++i) Serve(conn, fds[1], request);
+    before = allocations.load();
+    for (int i = 0; i < 1000; ++i) Serve(conn, fds[1], request);
+    count = allocations.load() - before;
+    std::cout << "cached, " << count << " allocations in 1000 requests\n";
+    assert(count == 0);
+
+    // debug logging into a binary appender formats nothing either
+    auto root = std::make_shared<Logger>(LogLevel::DEBUG, "root");
+    root->AddAppender(std::make_shared<BinaryLogAppender>(LogLevel::DEBUG, "alloc_test.log"));
+    LogManager::Instance().AddLogger(root);
+    for (int i = 0; i < 100; ++i) Serve(conn, fds[1], request);
+    before = allocations.load();
+    for (int i = 0; i < 1000; ++i) Serve(conn, fds[1], request);
+    count = allocations.load() - before;
+    std::cout << "debug logged, " << count << " allocations in 1000 requests\n";
+    assert(count == 0);
+    ::close(fds[1]);
+}
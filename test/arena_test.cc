@@ -0,0 +1,87 @@
+#include "http/http.hh"
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <sys/socket.h>
+
+// the arena of each connection is released between requests, what the
+// request and response kept from the last one must not alias the next;
+// short and long paths alternate so strings outgrow and drop their
+// small buffers on several connections at once
+static auto Serve(HttpConnection& conn, int peer, std::string_view path) -> std::string
+{
+    std::string request = std::format("GET {} HTTP/1.1\r\n"
+                                      "Host: 127.0.0.1\r\n"
+                                      "User-Agent: arena_test/{}\r\n"
+                                      "Connection: keep-alive\r\n"
+                                      "\r\n",
+                                      path, std::string(path.size() * 3, 'x'));
+    if (::send(peer, request.data(), request.size(), 0) != ssize_t(request.size())) std::abort();
+    conn.Read();
+    if (!conn.Process()) std::abort();
+    assert(conn.Request().Path() == path);
+
+    std::string response;
+    char buffer[1 << 16];
+    ssize_t len;
+    while (conn.ToWriteBytes()) {
+        conn.Write();
+        while ((len = ::recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) response.append(buffer, len);
+    }
+    while ((len = ::recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) response.append(buffer, len);
+    return response;
+}
+
+static auto Slurp(std::string const& path) -> std::string
+{
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+int main()
+{
+    HttpConnection::et = false;
+    HttpConnection::base_ = ".";
+
+    std::vector<std::string> paths {
+        "/test.yaml",
+        "/./././././././././././././././././././buffer_test.cc",
+        "/xmake.lua",
+        "/././././././././././././././config_test.cc",
+        "/http_test.cc",
+    };
+
+    constexpr int connections = 4;
+    std::vector<std::pair<int, int>> fds;
+    std::vector<std::unique_ptr<HttpConnection>> conns;
+    for (int i = 0; i < connections; ++i) {
+        int pair[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) < 0) std::abort();
+        fds.emplace_back(pair[0], pair[1]);
+        conns.emplace_back(new HttpConnection(pair[0], {}));
+    }
+
+    size_t served = 0;
+    for (int round = 0; round < 200; ++round) {
+        for (int i = 0; i < connections; ++i) {
+            auto const& path = paths[(round + i * 2) % paths.size()];
+            auto response = Serve(*conns[i], fds[i].second, path);
+            auto body = Slurp("." + path);
+
+            auto header_end = response.find("\r\n\r\n");
+            assert(response.starts_with("HTTP/1.1 200 OK\r\n"));
+            assert(header_end != std::string::npos);
+            assert(response.find(std::format("Content-Length: {}\r\n", body.size())) < header_end);
+            assert(response.substr(header_end + 4) == body);
+            assert(conns[i]->Code() == HttpCode::OK);
+            ++served;
+        }
+    }
+    std::cout << served << " responses on " << connections << " connections\n";
+
+    conns.clear();
+    for (auto [fd, peer] : fds) ::close(peer);
+}
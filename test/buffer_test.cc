@@ -1,7 +1,11 @@
 #include "buffer/buffer.hh"
 
+#include <cassert>
 #include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
 int main()
 {
@@ -11,6 +15,53 @@ int main()
     g.read(t);
     std::cout << g.view() << '\n';
 
+    // chained blocks, contiguous again once viewed
+    std::vector<std::byte> data(24 << 10, std::byte('x'));
+    Gulp chain;
+    chain.append(data);
+    std::cout << "blocks: " << chain.blocks() << " size: " << chain.size() << '\n';
+    assert(chain.blocks() == 2);
+    chain.consume(10 << 10);
+    assert(chain.blocks() == 2 && chain.size() == (14 << 10));
+    assert(chain.view().find_first_not_of('x') == std::string_view::npos);
+    assert(chain.blocks() == 1);
+    size_t free = BlockPool::Free();
+    chain.consume(chain.size());
+    assert(chain.blocks() == 0 && BlockPool::Free() == free + 1);
+    std::cout << "pooled blocks: " << BlockPool::Free() << '\n';
+
+    // a read takes one fresh block, more only while it fills them
+    int fds[2];
+    if (::pipe(fds) < 0) return 1;
+    Gulp piped;
+    std::string small(100, 's'), large(40 << 10, 'l');
+    assert(::write(fds[1], small.data(), small.size()) == ssize_t(small.size()));
+    free = BlockPool::Free();
+    assert(piped.read(fds[0]) == ssize_t(small.size()));
+    assert(piped.blocks() == 1 && BlockPool::Free() + 1 == free);
+    assert(::write(fds[1], large.data(), large.size()) == ssize_t(large.size()));
+    assert(piped.read(fds[0]) == ssize_t(large.size()));
+    assert(piped.blocks() == 3 && piped.view() == small + large);
+    ::close(fds[0]);
+    ::close(fds[1]);
+
+    // shared bytes keep their owner alive, appends go to a new block
+    auto owner = std::make_shared<std::string>("shared");
+    chain.append(std::as_bytes(std::span(std::string_view("not "))));
+    chain.share(owner, std::as_bytes(std::span(*owner)));
+    chain.append(std::as_bytes(std::span(std::string_view(" bytes"))));
+    assert(owner.use_count() == 2 && chain.blocks() == 3);
+    chain.consume(4);
+    assert(chain.view() == "shared bytes");
+
+    // handed to another thread and back
+    chain.handoff();
+    std::thread([&chain] {
+        chain.consume(7);
+        chain.handoff();
+    }).join();
+    assert(chain.view() == "bytes" && owner.use_count() == 1);
+
     Slurp s {"buffer_test.cc"};
     std::cout << s.view() << '\n';
 
@@ -19,4 +70,4 @@ int main()
         std::cout << s.state_message() << ": "
                   << s.error_message().value() << '\n';
     }
-}
\ No newline at end of file
+}
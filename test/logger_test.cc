@@ -1,5 +1,7 @@
 #include "log/log.hh"
 
+#include <cassert>
+
 int main()
 {
     auto p = std::make_shared<Logger>(LogLevel::DEBUG, "test");
@@ -19,14 +21,34 @@ int main()
         "file line number: %l%n ");
 
     p->AddAppender(std::make_shared<StdoutLogAppender>(LogLevel::INFO, formatter));
+    p->AddAppender(std::make_shared<StdoutLogAppender>(
+        LogLevel::INFO, LogFormatter::Compile<"compiled: [%p] [%c] %m%n">()));
     p->AddAppender(std::make_shared<FileLogAppender>(LogLevel::DEBUG, formatter, "log.log"));
 
-    auto e = std::make_shared<LogEvent>(
-        std::source_location::current().file_name(),
-        std::source_location::current().function_name(),
-        std::source_location::current().line(),
-        std::this_thread::get_id(), 0,
-        time(0), time(0), "test content");
+    auto e = LogEvent::Make(std::source_location::current(),
+                            "test {}", "content");
 
     p->Log(LogLevel::WARN, e);
-}
\ No newline at end of file
+
+    // floats print as written; a spec for a type stored as its "{}"
+    // string falls back to that string instead of throwing
+    static LogSite const float_site(std::source_location::current(), "{} {:%S}");
+    auto rendered = LogEvent::Make(float_site, "{} {:%S}", 0.1f, std::chrono::seconds(5));
+    std::cout << "rendered: " << rendered.Content() << '\n';
+    assert(rendered.Content() == "0.1 5s");
+
+    // events larger than a segment are cut, not rolled over forever
+    auto binary = std::make_shared<BinaryLogAppender>(LogLevel::DEBUG, "binary_test.log", 64 << 10);
+    auto large = std::make_shared<Logger>(LogLevel::DEBUG, "large");
+    large->AddAppender(binary);
+    static LogSite const site(std::source_location::current(), "large {}");
+    std::string text(128 << 10, 'x');
+    large->Log(LogLevel::INFO, LogEvent::Make(site, "large {}", text));
+    large->Log(LogLevel::INFO, LogEvent::Make(std::source_location::current(), "large {}", text));
+    std::cout << "truncated: " << binary->Truncated() << '\n';
+    assert(binary->Truncated() == 2);
+
+    // "test.route" reaches the appenders of "test" by name
+    LogManager::Instance().AddLogger(p);
+    LOG_TO("test.route", LogLevel::WARN, "routed {}", 42);
+}
@@ -0,0 +1,75 @@
+#include "thread/thread.hh"
+
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// one thread held up by a task until the returned promise is set
+static auto Block(ThreadPool& pool) -> std::promise<void>
+{
+    std::promise<void> gate;
+    pool.AddTask([future = gate.get_future().share()] { future.wait(); });
+    return gate;
+}
+
+struct Log {
+    std::mutex mtx;
+    std::vector<int> ran, dropped;
+
+    auto Task(int i)
+    {
+        return [this, i](bool drop) {
+            std::lock_guard lock(mtx);
+            (drop ? dropped : ran).push_back(i);
+        };
+    }
+
+    void Wait(size_t count)
+    {
+        while (true) {
+            {
+                std::lock_guard lock(mtx);
+                if (ran.size() + dropped.size() >= count) return;
+            }
+            std::this_thread::sleep_for(1ms);
+        }
+    }
+};
+
+int main()
+{
+    // a standing queue: stale tasks are dropped, the fresh ones run
+    // newest first
+    {
+        ThreadPool pool(1, {ThreadPool::Discipline::ADAPTIVE, 5, 20, 0});
+        Log log;
+        auto gate = Block(pool);
+        for (int i = 0; i < 10; ++i) pool.AddTask(log.Task(i));
+        std::this_thread::sleep_for(50ms);
+        for (int i = 10; i < 13; ++i) pool.AddTask(log.Task(i));
+        gate.set_value();
+        log.Wait(13);
+        std::cout << "adaptive: " << log.ran.size() << " ran, " << log.dropped.size() << " dropped\n";
+        assert(log.dropped == std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+        assert(log.ran == std::vector<int>({12, 11, 10}));
+    }
+
+    // in order, only what is past the deadline is dropped
+    {
+        ThreadPool pool(1, {ThreadPool::Discipline::FIFO, 5, 20, 20});
+        Log log;
+        auto gate = Block(pool);
+        pool.AddTask(log.Task(0));
+        std::this_thread::sleep_for(40ms);
+        for (int i = 1; i < 4; ++i) pool.AddTask(log.Task(i));
+        gate.set_value();
+        log.Wait(4);
+        std::cout << "fifo: " << log.ran.size() << " ran, " << log.dropped.size() << " dropped\n";
+        assert(log.dropped == std::vector<int>({0}));
+        assert(log.ran == std::vector<int>({1, 2, 3}));
+    }
+}
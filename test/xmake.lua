@@ -13,6 +13,6 @@ for _, file in ipairs(os.files("*.cc")) do
         end)
         set_kind("binary")
         add_files(file)
-        add_deps("log", "config", "timer", "http", "buffer")
+        add_deps("log", "config", "timer", "http", "buffer", "thread")
     target_end()
 end
\ No newline at end of file
@@ -11,6 +11,7 @@ set_optimize("fastest")
 add_requires("yaml-cpp", {system = true})
 add_requires("pqxx", {system = true})
 add_requires("pq", {system = true})
+add_requires("zlib", {system = true})
 
 add_requires("boost", {configs = {fiber = true}})
 
@@ -20,7 +21,11 @@ add_includedirs("inc", "src")
 
 add_rules("mode.debug", "mode.release")
 
-includes("src", "test", "xmake")
+if is_mode("release") then
+    add_defines("LOG_ACTIVE_LEVEL=LogLevel::INFO")
+end
+
+includes("src", "test", "bench", "xmake")
 
 task("test")
     on_run(function ()